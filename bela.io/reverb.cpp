@@ -16,10 +16,13 @@ how to run with frame size = 32:
 */
 
 #include <Bela.h>
-#include <libraries/ne10/NE10.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+
+#include "../inc/simd.h"
 
 const int iMAX_BUFFER_SIZE = (2*48000); // 2 seconds max reverb
 
@@ -41,7 +44,8 @@ const float fAP3_GAIN = 0.7f;
 
 int32_t inL, inR, outL, outR;
 
-// Buffer
+// Buffer, all in fLines
+float *fLines;
 float *fFFCF1;
 float *fFFCF2;
 float *fFFCF3;
@@ -59,6 +63,13 @@ int iAP1 = 0;
 int iAP2 = 0;
 int iAP3 = 0;
 
+// Work buffers of one render() call, longer calls are split
+#define MAX_BLOCK 256
+float fInput[MAX_BLOCK];
+float fAPOut[MAX_BLOCK];
+float fComb[4][MAX_BLOCK];
+float fOut[MAX_BLOCK];
+
 float dryWet = 0;
 float modDryWet = 0;
 float roomSize = 0;
@@ -67,6 +78,38 @@ float modRoomSize = 0;
 // Set the analog channels to read from
 int gAudioFramesPerAnalogFrame = 0;
 
+// Budget governor: when processing takes too much of the block period,
+// quality steps down one level at a time, and back up once the headroom
+// has been there for a while:
+//   0 full, 1 without AP3, 2 without AP2 and AP3, 3 two combs (+3 dB)
+// A stage fades in or out over GOV_FADE frames. While it is off its delay
+// line is cleared GOV_CLEAR floats per render() call, a stage only comes
+// back once that is done so nothing stale is replayed.
+#define GOV_NUM_LEVELS  4
+#define GOV_FADE        512    // frames
+#define GOV_CLEAR       1024   // floats of a line cleared per call while its stage is off
+#define GOV_CPU_HZ      1e9f   // AM335x
+#define GOV_HIGH        0.5f   // share of the block period to step down at
+#define GOV_LOW         0.25f  // and to step up below
+#define GOV_SETTLE      0.1f   // s between steps down
+#define GOV_HOLD        2.f    // s of headroom before a step up
+
+enum { STAGE_AP1, STAGE_AP2, STAGE_AP3, STAGE_FFCF1, STAGE_FFCF2, STAGE_FFCF3, STAGE_FFCF4, NUM_STAGES };
+
+// First level without the stage
+const int iStageDropLevel[NUM_STAGES] = { GOV_NUM_LEVELS, 2, 1, GOV_NUM_LEVELS, GOV_NUM_LEVELS, 3, 3 };
+
+int iGovLevel = 0;
+float fStageGain[NUM_STAGES];  // 0 bypassed ... 1 active
+int iStageCleared[NUM_STAGES]; // floats of the line cleared since the stage went off
+float fGovLoad = 0.f;          // smoothed share of the block period
+float fGovPeak = 0.f;          // highest single block since the last status line
+uint32_t uGovSwitches = 0;
+uint32_t uGovOverruns = 0;     // render() calls that took longer than the period
+uint32_t uGovBlocks = 0;       // since the last step
+float fGamma[MAX_BLOCK];       // per sample gain of the stage that fades
+float fWetMakeup = 1.f;        // of the two comb bank
+
 // cpu cycle read
 static inline uint32_t ccnt_read (void)
 {
@@ -87,33 +130,27 @@ bool setup(BelaContext *context, void *userData)
     printf("context->audioInChannels = %d\n", context->audioInChannels);
     printf("context->audioOutChannels = %d\n", context->audioOutChannels);
 
-    fFFCF1 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fFFCF1)
+    // One block for all delay lines, zeroed so the first pass outputs
+    // silence rather than whatever the heap held. That also faults every
+    // page in, locked they stay so render() never takes a page fault.
+    const size_t lineBytes = NUM_STAGES*iMAX_BUFFER_SIZE*sizeof(float);
+    fLines = (float*)malloc(lineBytes);
+    if(!fLines)
         return false;
+    memset(fLines, 0, lineBytes);
+    if(mlock(fLines, lineBytes) != 0)
+        printf("WARNING: unable to lock the delay lines\n");
 
-    fFFCF2 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fFFCF2)
-        return false;
+    fAP1 = fLines + STAGE_AP1*iMAX_BUFFER_SIZE;
+    fAP2 = fLines + STAGE_AP2*iMAX_BUFFER_SIZE;
+    fAP3 = fLines + STAGE_AP3*iMAX_BUFFER_SIZE;
+    fFFCF1 = fLines + STAGE_FFCF1*iMAX_BUFFER_SIZE;
+    fFFCF2 = fLines + STAGE_FFCF2*iMAX_BUFFER_SIZE;
+    fFFCF3 = fLines + STAGE_FFCF3*iMAX_BUFFER_SIZE;
+    fFFCF4 = fLines + STAGE_FFCF4*iMAX_BUFFER_SIZE;
 
-    fFFCF3 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fFFCF3)
-        return false;
-
-    fFFCF4 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fFFCF4)
-        return false;
-
-    fAP1 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fAP1)
-        return false;
-
-    fAP2 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fAP2)
-        return false;
-
-    fAP3 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fAP3)
-        return false;
+    for(int k = 0; k < NUM_STAGES; k++)
+        fStageGain[k] = 1.f;
 
     roomSize = 0.65f;
     dryWet = 0.24f;
@@ -276,6 +313,222 @@ float processMM(float x1, float x2, float x3, float x4)
     return hardClip(OutA);
 }
 
+// Process n samples of an all pass, same results as processAP(). Within
+// one pass over the delay line no position is read after it was written,
+// so the output of each run up to the wrap is computed in vectors from the
+// old line values. The line recursion itself stays scalar.
+void processAPBlock(const float* x, float* y, int n, float g, float* state, int* i, int iBufsize)
+{
+    const vf_t vng = vf_set1(-g);
+    const vf_t vk = vf_set1(1 - g*g);
+    const vf_t lo = vf_set1(MIN_SMP_VAL);
+    const vf_t hi = vf_set1(MAX_SMP_VAL);
+    int index = *i;
+
+    while(n > 0)
+    {
+        int run = iBufsize + 1 - index;
+        if(run > n)
+            run = n;
+        float* line = &state[index];
+        float prev = state[(index-1+iBufsize)%iBufsize];
+        int s = 0;
+
+        for(; s + SIMD_LANES <= run; s += SIMD_LANES)
+        {
+            const vf_t vx = vf_loadu(&x[s]);
+            const vf_t vy = vf_clamp((vng * vx + vf_loadu(&line[s])) * vk, lo, hi);
+
+            for(int l = 0; l < SIMD_LANES; l++)
+            {
+                line[s + l] = hardClip(g * prev + g * vx[l]);
+                prev = line[s + l];
+            }
+
+            vf_storeu(&y[s], vy);
+        }
+
+        for(; s < run; s++)
+        {
+            const float xs = x[s];
+            float ys = -g * xs + line[s];
+            ys *= (1 - g*g);
+
+            line[s] = hardClip(g * prev + g * xs);
+            prev = line[s];
+
+            y[s] = hardClip(ys);
+        }
+
+        index += run;
+        if(index > iBufsize)
+            index = 0;
+
+        x += run;
+        y += run;
+        n -= run;
+    }
+
+    *i = index;
+}
+
+// Process n samples of a feed forward comb filter, same results as processFFCF()
+void processFFCFBlock(const float* x, float* y, int n, float g, float* state, int* i, int iBufsize)
+{
+    const vf_t vg = vf_set1(g);
+    const vf_t lo = vf_set1(MIN_SMP_VAL);
+    const vf_t hi = vf_set1(MAX_SMP_VAL);
+    int index = *i;
+
+    while(n > 0)
+    {
+        int run = iBufsize + 1 - index;
+        if(run > n)
+            run = n;
+        float* line = &state[index];
+        int s = 0;
+
+        for(; s + SIMD_LANES <= run; s += SIMD_LANES)
+        {
+            const vf_t vx = vf_loadu(&x[s]);
+            vf_storeu(&y[s], vf_clamp(vf_madd(vg, vx, vg * vf_loadu(&line[s])), lo, hi));
+            vf_storeu(&line[s], vx);
+        }
+
+        for(; s < run; s++)
+        {
+            const float xs = x[s];
+            y[s] = hardClip(g * xs + g * line[s]);
+            line[s] = xs;
+        }
+
+        index += run;
+        if(index > iBufsize)
+            index = 0;
+
+        x += run;
+        y += run;
+        n -= run;
+    }
+
+    *i = index;
+}
+
+// Per sample gains from the current to the target gain of a stage,
+// false if the stage is settled at the target
+bool fadeStage(int stage, int frames)
+{
+    const float target = (iGovLevel < iStageDropLevel[stage]) ? 1.f : 0.f;
+    float g = fStageGain[stage];
+
+    if(g == target)
+        return false;
+
+    const float step = (target > g) ? 1.f / GOV_FADE : -1.f / GOV_FADE;
+    for(int n = 0; n < frames; n++)
+    {
+        g += step;
+        g = (step > 0.f) ? fminf(g, target) : fmaxf(g, target);
+        fGamma[n] = g;
+    }
+    fStageGain[stage] = g;
+
+    return true;
+}
+
+// Clear the next piece of the line of a stage that is off, true once the
+// whole line is clean. Spread out like this no single render() call pays
+// for a full line, least of all the one the governor found headroom in.
+bool clearStage(int stage, float* state, int* i, int iBufsize)
+{
+    const int size = iBufsize + 1;
+    const int done = iStageCleared[stage];
+
+    if(done < size)
+    {
+        const int len = (size - done < GOV_CLEAR) ? size - done : GOV_CLEAR;
+        memset(&state[done], 0, len * sizeof(float));
+        iStageCleared[stage] = done + len;
+        *i = 0;
+    }
+
+    return iStageCleared[stage] == size;
+}
+
+// All pass stage with bypass, x and y may be the same buffer
+void processAPStage(int stage, const float* x, float* y, int frames, float g, float* state, int* i, int iBufsize)
+{
+    // An off stage stays off until its line is clean
+    const bool clean = (fStageGain[stage] != 0.f) || clearStage(stage, state, i, iBufsize);
+
+    if(!clean || !fadeStage(stage, frames))
+    {
+        if(fStageGain[stage] == 1.f)
+            processAPBlock(x, y, frames, g, state, i, iBufsize);
+        else if(x != y)
+            memcpy(y, x, frames * sizeof(float));
+        return;
+    }
+
+    // Fading in or out, the line is written again
+    iStageCleared[stage] = 0;
+
+    processAPBlock(x, fOut, frames, g, state, i, iBufsize);
+    for(int n = 0; n < frames; n++)
+        y[n] = x[n] + fGamma[n] * (fOut[n] - x[n]);
+}
+
+// Feed forward comb stage with bypass, a bypassed comb outputs silence
+void processFFCFStage(int stage, const float* x, float* y, int frames, float g, float* state, int* i, int iBufsize)
+{
+    const bool clean = (fStageGain[stage] != 0.f) || clearStage(stage, state, i, iBufsize);
+
+    if(!clean || !fadeStage(stage, frames))
+    {
+        if(fStageGain[stage] == 1.f)
+            processFFCFBlock(x, y, frames, g, state, i, iBufsize);
+        else
+            memset(y, 0, frames * sizeof(float));
+        return;
+    }
+
+    iStageCleared[stage] = 0;
+
+    processFFCFBlock(x, y, frames, g, state, i, iBufsize);
+    for(int n = 0; n < frames; n++)
+        y[n] *= fGamma[n];
+}
+
+// One decision per render() call from the share of the period it took
+void governor(BelaContext *context, uint32_t cycles)
+{
+    const float period = context->audioFrames * GOV_CPU_HZ / context->audioSampleRate;
+    const float load = cycles / period;
+    const float blocksPerSecond = context->audioSampleRate / context->audioFrames;
+    const int from = iGovLevel;
+
+    fGovLoad += 0.05f * (load - fGovLoad);
+    fGovPeak = fmaxf(fGovPeak, load);
+    if(load > 1.f)
+        uGovOverruns++;
+    uGovBlocks++;
+
+    // A single slow block steps down, the next step waits until the
+    // previous one has shown its effect
+    if((load > GOV_HIGH || fGovLoad > GOV_HIGH) && iGovLevel < GOV_NUM_LEVELS - 1 &&
+       uGovBlocks >= GOV_SETTLE * blocksPerSecond)
+        iGovLevel++;
+    else if(fGovLoad < GOV_LOW && fGovPeak < GOV_HIGH && iGovLevel > 0 && uGovBlocks >= GOV_HOLD * blocksPerSecond)
+        iGovLevel--;
+
+    if(iGovLevel != from)
+    {
+        uGovSwitches++;
+        uGovBlocks = 0;
+        rt_printf("\ngovernor: level %d -> %d, load %.0f%% (smoothed %.0f%%)\n", from, iGovLevel, load * 100.f, fGovLoad * 100.f);
+    }
+}
+
 void render(BelaContext *context, void *userData)
 {
 
@@ -309,47 +562,80 @@ void render(BelaContext *context, void *userData)
         }
 #endif
 
-    for(unsigned int n = 0; n < context->audioFrames; n++)
+    for(unsigned int start = 0; start < context->audioFrames; start += MAX_BLOCK)
     {
-        float fInL = 0;
-        float fInR = 0;
+        const int frames = (context->audioFrames - start < MAX_BLOCK) ? context->audioFrames - start : MAX_BLOCK;
 
         // Read audio inputs
-        fInL = audioRead(context,n,0);
-        fInR = audioRead(context,n,1);
+        for(int n = 0; n < frames; n++)
+            fInput[n] = (audioRead(context, start+n, 0) + audioRead(context, start+n, 1)) * 0.5f;
 
         t0 = ccnt_read();
 
-        float fInput = (fInL + fInR) * 0.5f;
+        // Process, one stage at a time over the block
+        processAPStage(STAGE_AP1, fInput, fAPOut, frames, fAP1_GAIN, fAP1, &iAP1, iAP1_BUFFER_SIZE);
+        processAPStage(STAGE_AP2, fAPOut, fAPOut, frames, fAP2_GAIN, fAP2, &iAP2, iAP2_BUFFER_SIZE);
+        processAPStage(STAGE_AP3, fAPOut, fAPOut, frames, fAP3_GAIN, fAP3, &iAP3, iAP3_BUFFER_SIZE);
+
+        processFFCFStage(STAGE_FFCF1, fAPOut, fComb[0], frames, fFFCF1_GAIN, fFFCF1, &iFFCF1, iFFCF1_BUFFER_SIZE);
+        processFFCFStage(STAGE_FFCF2, fAPOut, fComb[1], frames, fFFCF2_GAIN, fFFCF2, &iFFCF2, iFFCF2_BUFFER_SIZE);
+        processFFCFStage(STAGE_FFCF3, fAPOut, fComb[2], frames, fFFCF3_GAIN, fFFCF3, &iFFCF3, iFFCF3_BUFFER_SIZE);
+        processFFCFStage(STAGE_FFCF4, fAPOut, fComb[3], frames, fFFCF4_GAIN, fFFCF4, &iFFCF4, iFFCF4_BUFFER_SIZE);
 
-        // Process
-        float ap = fInput;
+        // Two uncorrelated combs carry half the power of four, made up as
+        // the upper pair fades out. Linear over the block, click free.
+        const float makeupStart = fWetMakeup;
+        fWetMakeup = 1.f + (sqrtf(2.f) - 1.f) * (1.f - fStageGain[STAGE_FFCF3]);
 
-        ap = processAP(ap, fAP1_GAIN, fAP1, &iAP1, iAP1_BUFFER_SIZE);
-        ap = processAP(ap, fAP2_GAIN, fAP2, &iAP2, iAP2_BUFFER_SIZE);
-        ap = processAP(ap, fAP3_GAIN, fAP3, &iAP3, iAP3_BUFFER_SIZE);
-        
-        float fOutput = processFFCF(ap, fFFCF1_GAIN, fFFCF1, &iFFCF1, iFFCF1_BUFFER_SIZE);
-        fOutput = hardClip(fOutput + processFFCF(ap, fFFCF2_GAIN, fFFCF2, &iFFCF2, iFFCF2_BUFFER_SIZE));
-        fOutput = hardClip(fOutput + processFFCF(ap, fFFCF3_GAIN, fFFCF3, &iFFCF3, iFFCF3_BUFFER_SIZE));
-        fOutput = hardClip(fOutput + processFFCF(ap, fFFCF4_GAIN, fFFCF4, &iFFCF4, iFFCF4_BUFFER_SIZE));
+        const vf_t lo = vf_set1(MIN_SMP_VAL);
+        const vf_t hi = vf_set1(MAX_SMP_VAL);
+        const vf_t dry = vf_set1(1.f - dryWet);
+        int n = 0;
+
+        if(makeupStart == 1.f && fWetMakeup == 1.f)
+        {
+            const vf_t wet = vf_set1(dryWet);
+
+            for(; n + SIMD_LANES <= frames; n += SIMD_LANES)
+            {
+                vf_t v = vf_clamp(vf_loadu(&fComb[0][n]) + vf_loadu(&fComb[1][n]), lo, hi);
+                v = vf_clamp(v + vf_loadu(&fComb[2][n]), lo, hi);
+                v = vf_clamp(v + vf_loadu(&fComb[3][n]), lo, hi);
+                vf_storeu(&fOut[n], vf_clamp(vf_madd(dry, vf_loadu(&fInput[n]), v * wet), lo, hi));
+            }
+        }
 
-        fOutput *= dryWet;
-        fOutput = hardClip(fOutput + (1.f - dryWet) * fInput);
+        for(; n < frames; n++)
+        {
+            const float makeup = makeupStart + (fWetMakeup - makeupStart) * (n + 1) / frames;
+            float fOutput = hardClip(hardClip(hardClip(fComb[0][n] + fComb[1][n]) + fComb[2][n]) + fComb[3][n]);
+            fOutput *= dryWet * makeup;
+            fOut[n] = hardClip(fOutput + (1.f - dryWet) * fInput[n]);
+        }
 
         t1 = ccnt_read();
         tMean += (t1-t0);
         //rt_printf("\r\r\rdryWet = %f, roomSize = %f ####  %u cycles process", dryWet, roomSize, t1-t0);    
 
-        // Write the output sample
-        audioWrite(context, n, 0, fOutput);
-        audioWrite(context, n, 1, fOutput);
+        // Write the output samples
+        for(n = 0; n < frames; n++)
+        {
+            audioWrite(context, start+n, 0, fOut[n]);
+            audioWrite(context, start+n, 1, fOut[n]);
+        }
     }
 
-    rt_printf("\r\r\rdryWet = %f, roomSize = %f ####  %u cycles process", dryWet, roomSize, tMean/context->audioFrames); 
+    governor(context, tMean);
+
+    rt_printf("\r\r\rdryWet = %f, roomSize = %f ####  %u cycles process, level %d, load %.0f%% (peak %.0f%%), %u switches, %u overruns",
+              dryWet, roomSize, tMean/context->audioFrames, iGovLevel, fGovLoad * 100.f, fGovPeak * 100.f, uGovSwitches, uGovOverruns);
+    fGovPeak = fmaxf(0.f, fGovPeak - 0.001f);
 }
 
 void cleanup(BelaContext *context, void *userData)
 {
-
+    if(fLines)
+        munlock(fLines, NUM_STAGES*iMAX_BUFFER_SIZE*sizeof(float));
+    free(fLines);
+    fLines = NULL;
 }
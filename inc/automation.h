@@ -0,0 +1,88 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Offline parameter automation from a breakpoint file, one breakpoint per
+  line, # starts a comment:
+
+    # time s  parameter  value (percent, like the command line)
+    0.0       dryWet     20
+    4.0       dryWet     60
+    0.0       modReverb  10
+    8.0       modReverb  50
+
+  Values ramp linearly between the breakpoints of a parameter and hold
+  before the first and after the last one. Evaluation is lazy: a block
+  that lies in a flat segment costs one comparison. dryWet ramps are
+  sample accurate, modReverb follows at AUTOMATION_CONTROL_BLOCK frames
+  because it changes integer delay lengths; neither reallocates anything.
+*/
+
+#ifndef AUTOMATION_H
+#define AUTOMATION_H
+
+#include <stdint.h>
+
+#include "reverb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUTOMATION_CONTROL_BLOCK 256 // frames per modReverb update in a ramp
+
+enum
+{
+    AUTOMATION_DRYWET,
+    AUTOMATION_MOD,
+    AUTOMATION_NUM_PARAMS
+};
+
+typedef struct automation_point
+{
+    int64_t frame;
+    float value;
+} automation_point_t;
+
+typedef struct automation_lane
+{
+    automation_point_t* points; // ascending frames
+    int num;
+    int cursor;                 // first point after the last frame evaluated
+} automation_lane_t;
+
+typedef struct automation
+{
+    automation_lane_t lane[AUTOMATION_NUM_PARAMS];
+    struct rt_arena* arena; // where the points live, NULL for the heap
+} automation_t;
+
+bool automation_load(automation_t* a, const char* path, int sample_rate);
+void automation_cleanup(automation_t* a);
+// Bytes automation_move_to_arena() takes from an arena
+size_t automation_memory_size(const automation_t* a);
+// Move the breakpoints into an arena (rt.h), they are loaded on the heap
+bool automation_move_to_arena(automation_t* a, struct rt_arena* arena);
+
+// Number of breakpoints of a parameter
+int automation_points(const automation_t* a, int param);
+
+// Frames are evaluated in ascending order only, across calls too
+float automation_value(automation_t* a, int param, int64_t frame);
+
+// Values of frames pos...pos+n-1. Returns false if the parameter is
+// constant over the block, then only *value is set (left alone without
+// breakpoints) and values is untouched.
+bool automation_ramp(automation_t* a, int param, int64_t pos, int n, float* values, float* value);
+
+// reverb_process_block() of frames pos...pos+n-1 with rv->modReverb
+// following the automation
+void automation_process_block(automation_t* a, reverb_t* rv, int64_t pos, const float* in, float* wet, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
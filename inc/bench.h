@@ -0,0 +1,36 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Synthetic benchmarks of the reverb engines.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Time the full rate network against the decimated ones on white noise and
+// compare the octave band spectra of their wet outputs, then the Schroeder
+// kernels against the comb8 and velvet engines at full rate, in ns and
+// time stamp counter cycles per sample (x86 only).
+// modReverb in 0...1, returns 0 on success
+int bench_run(float modReverb, FILE* info);
+
+// Read the data of wavfile and write as much through the stdio and the
+// io_uring backends of the WAV reader / writer (wavreader.h), in MB/s.
+// The copy goes next to wavfile and is removed. Returns 0 when both read
+// the same and every copy reads back as written.
+int bench_io(const char* wavfile, FILE* info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Comb bank of REVERB_ENGINE_COMB8: eight feedback combs with a one-pole
+  lowpass in the loop (Freeverb style), fed by the same three allpasses
+  as the Schroeder network. The delay lines are interleaved, one row of
+  eight lanes per sample, with one write position shared by all lanes:
+
+    line[row * 8 + lane]
+
+  so a sample is one row store of all lanes, one AVX register or two
+  SSE / NEON registers, and eight reads at the lanes' delays. Damping and
+  feedback run across the lanes.
+*/
+
+#ifndef COMB8_H
+#define COMB8_H
+
+#include "reverb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Allocate the line for the longest delay at rv->decimation
+bool comb8_setup(reverb_t* rv);
+void comb8_cleanup(reverb_t* rv);
+// Bytes comb8_setup() takes from an arena
+size_t comb8_memory_size(int decimation);
+
+// Delays from rv->modReverb, the line is not reallocated
+void comb8_set_mod(reverb_t* rv);
+void comb8_reset(reverb_t* rv);
+
+void comb8_process(reverb_t* rv, const float* in, float* out, int n);
+
+// Peak and sum of squares of the rows the delays still reach and the
+// lowpass state
+void comb8_peak_energy(const reverb_t* rv, float* peak, double* energy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,62 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Golden output conformance and performance regression check. A fixed
+  corpus of generated signals (impulse, noise, sine sweep, silence to
+  signal, full scale noise) is rendered through every engine, kernel and
+  decimation:
+
+  - all kernels of an engine must match each other bit exactly, the scan
+    kernel within CONFORM_TOLERANCE
+  - every output must match the stored reference within
+    CONFORM_TOLERANCE, bit exact is reported separately
+  - the cost of every variant is compared with the stored baseline of
+    this host and reported when it grew beyond CONFORM_MAX_SLOWDOWN. It
+    is not counted as a failure, timing on a loaded or single core
+    machine is too noisy to block on.
+
+  The cost is ns/sample divided by that of a fixed calibration loop (plain
+  feedback combs over lines of the engine's size) timed in the same run,
+  so a slower clock or other load on the machine largely cancels out. The
+  timing runs in rounds with freshly allocated engines, since where the
+  lines land in memory moves the speed too. In each round every variant is
+  warmed up, then the repeats go round robin over the variants and the
+  calibration loop. The best of all rounds counts.
+
+  References are raw little endian float32 wet outputs, one file per
+  signal, engine and decimation. The baseline is a text file with a
+  version line and one line per host and variant:
+
+    conform-baseline 2
+    <host> <variant> <cost>
+*/
+
+#ifndef CONFORM_H
+#define CONFORM_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One int16 LSB. IEEE builds with -ffp-contract=off are bit exact, this
+// leaves room for targets that flush denormals or round expf differently.
+#define CONFORM_TOLERANCE 1.f
+
+// Report a variant that got more than 30% slower than its baseline
+#define CONFORM_MAX_SLOWDOWN 1.3
+
+// Check against the references and baseline in dir, returns 0 if all
+// pass. With record the references and this host's baseline are
+// (re)written from the current build instead.
+int conform_run(const char* dir, bool record, FILE* info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
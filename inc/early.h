@@ -0,0 +1,68 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Early reflections: one shared delay line read by a table of taps, each
+  with its own delay, gain and pan. The mono sum of all taps feeds the
+  AP/FFCF network, the panned left / right sums are added to its wet
+  output, so the first reflections keep their direction.
+
+  Tap table file, one tap per line, # starts a comment:
+
+    # delay in ms   gain   pan -1 (left) ... 1 (right)
+      7.1           0.80   -0.6
+      11.3          0.62    0.4
+*/
+
+#ifndef EARLY_H
+#define EARLY_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EARLY_MAX_TAPS  64
+#define EARLY_MAX_DELAY 1000.f // ms
+#define EARLY_BLOCK     4096   // frames per pass over the taps
+
+typedef struct early
+{
+    float* line;          // power of two length, written once per sample
+    struct rt_arena* arena; // where line lives, NULL for the heap
+    int mask;
+    int write;            // next write position
+    int numTaps;
+    int delay[EARLY_MAX_TAPS]; // samples
+    float gain[EARLY_MAX_TAPS];
+    float gainL[EARLY_MAX_TAPS];
+    float gainR[EARLY_MAX_TAPS];
+} early_t;
+
+// Read a tap table, delays are converted at sample_rate. Returns false and
+// prints the reason on bad input.
+bool early_load(early_t* er, const char* path, int sample_rate);
+void early_cleanup(early_t* er);
+// Bytes early_move_to_arena() takes from an arena
+size_t early_memory_size(const early_t* er);
+// Move the line into an arena (rt.h) before the first block
+bool early_move_to_arena(early_t* er, struct rt_arena* arena);
+
+// Feed n input samples, mono gets the sum of all taps for the network,
+// left / right the panned sums
+void early_process(early_t* er, const float* in, float* mono, float* left, float* right, int n);
+
+// left / right += wet, saturating
+void early_add_wet(const float* wet, float* left, float* right, int n);
+
+// Peak and sum of squares of the input history the taps still reach
+void early_peak_energy(const early_t* er, float* peak, double* energy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Polyphase half-band FIR decimator and interpolator by 2.
+  Every other coefficient of a half-band filter is zero, so one output
+  costs HALFBAND_PAIRS multiplications of symmetric sample pairs.
+  Both work on blocks, the inner loops run over output samples and
+  vectorize.
+*/
+
+#ifndef HALFBAND_H
+#define HALFBAND_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Non-zero coefficient pairs around the 0.5 center tap, 4*10-1 = 39 taps,
+// passband up to 0.2 fs, >= 60 dB stopband from 0.3 fs
+#define HALFBAND_PAIRS 10
+#define HALFBAND_LEN   (4*HALFBAND_PAIRS-1)
+
+// Largest number of input samples per call
+#define HALFBAND_MAX_BLOCK 1024
+
+typedef struct halfband_dec
+{
+    float hist[HALFBAND_LEN-1]; // last inputs, oldest first
+    int phase;                  // inputs since the last output, 0 or 1
+} halfband_dec_t;
+
+typedef struct halfband_int
+{
+    float hist[2*HALFBAND_PAIRS-1];
+} halfband_int_t;
+
+void halfband_dec_init(halfband_dec_t* hb);
+void halfband_int_init(halfband_int_t* hb);
+
+// Filter n input samples, writes the half rate outputs to y and returns
+// how many there are
+int halfband_decimate(halfband_dec_t* hb, const float* x, int n, float* y);
+
+// Filter n half rate samples, writes 2*n full rate outputs to z
+void halfband_interpolate(halfband_int_t* hb, const float* y, int n, float* z);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
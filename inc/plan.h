@@ -0,0 +1,66 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Kernel planner. Which network kernel and block length are fastest
+  depends on the machine and on the delay lengths, so candidates are timed
+  on synthetic input once per host and configuration. The winner is kept
+  in a wisdom file that later runs read instead of measuring again.
+  Only the bit exact kernels are candidates, the output must not depend on
+  the host or on timing noise, so the scan kernel is never planned.
+
+  Wisdom is a text file, one plan per line:
+
+    <host> <decimation> <modReverb> <effort> <kernel> <block> <ns/sample>
+*/
+
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PLAN_WISDOM_VERSION 4 // bump when the candidates change, old wisdom is ignored
+
+enum
+{
+    PLAN_ESTIMATE,   // no timing, a heuristic pick
+    PLAN_MEASURE,    // time the kernels at the default block length
+    PLAN_EXHAUSTIVE  // time every kernel at every block length
+};
+
+typedef struct plan
+{
+    int kernel;         // REVERB_KERNEL_*
+    int block;          // frames per processing block
+    int effort;         // PLAN_* that produced this plan
+    double nsPerSample; // measured, 0 for estimates
+} plan_t;
+
+#define PLAN_MAX_BLOCK 16384
+
+// "estimate", "measure" or "exhaustive", returns -1 otherwise
+int plan_parse_effort(const char* name);
+const char* plan_effort_name(int effort);
+
+// $HOME/.reverb_wisdom, NULL if there is no home directory
+const char* plan_default_wisdom(void);
+
+// Name of this machine without whitespace, the key of per host files
+void plan_host_name(char* name, size_t size);
+
+// Find or measure the plan for this host and configuration. Wisdom of at
+// least the requested effort is used as is, new measurements are written
+// back. wisdom may be NULL to neither read nor write a file.
+void plan_create(plan_t* plan, int decimation, float modReverb, int effort, const char* wisdom, FILE* info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
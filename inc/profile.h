@@ -0,0 +1,103 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Per stage cost attribution, compiled in with -DREVERB_PROFILE (make
+  profile). Every PROF_SAMPLE_EVERY-th block is sampled: its stages are
+  timed with the cycle counter and the network runs staged, one AP/FFCF
+  at a time, so each delay line gets its own number. All other blocks
+  only take one timestamp pair for the whole chain.
+
+    prof_block_begin();
+    uint64_t t0 = PROF_START();
+    ... stage ...
+    PROF_STOP(PROF_MIX, t0);
+    prof_block_end(frames);
+
+  Without REVERB_PROFILE all of it compiles to nothing.
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROF_SAMPLE_EVERY 16
+
+enum
+{
+    PROF_WAV_READ,
+    PROF_READ_S16,
+    PROF_EARLY,
+    PROF_DECIMATE,
+    PROF_AP1,
+    PROF_AP2,
+    PROF_AP3,
+    PROF_FFCF1,
+    PROF_FFCF2,
+    PROF_FFCF3,
+    PROF_FFCF4,
+    PROF_COMB8,
+    PROF_VELVET,
+    PROF_INTERPOLATE,
+    PROF_MIX,
+    PROF_WRITE_S16,
+    PROF_WAV_WRITE,
+    PROF_NUM_STAGES
+};
+
+#ifdef REVERB_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+extern int prof_active; // the current block is sampled
+
+static inline uint64_t prof_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+void prof_block_begin(void);
+void prof_block_end(int frames);
+void prof_record(int stage, uint64_t t0);
+
+// Flat report to info, Chrome trace / Perfetto JSON of the sampled blocks
+// to trace unless it is NULL
+void prof_report(FILE* info, const char* trace);
+
+#define PROF_START() (prof_active ? prof_ticks() : 0)
+#define PROF_STOP(stage, t0) do { if(prof_active) prof_record((stage), (t0)); } while(0)
+
+#else
+
+#define prof_active 0
+#define prof_block_begin()
+#define prof_block_end(frames)
+#define prof_report(info, trace) ((void)(info), (void)(trace))
+#define PROF_START() 0
+#define PROF_STOP(stage, t0) ((void)(t0))
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
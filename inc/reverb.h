@@ -0,0 +1,195 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Schroeders reverb engine shared by the x86 tools.
+  All state of one reverberator lives in a reverb_t, so several
+  instances can run side by side.
+*/
+
+#ifndef REVERB_H
+#define REVERB_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "halfband.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REVERB_NUM_AP   3
+#define REVERB_NUM_FFCF 4
+
+#define REVERB_MAX_DECIMATION 4
+
+extern const int iMAX_BUFFER_SIZE; // 2 seconds max reverb
+
+// Implementations of the AP/FFCF network, all produce identical output
+// except scan. Scan is not bit exact: it stays within CONFORM_TOLERANCE of
+// the others, and its rounding depends on how the input is split into
+// blocks, so a resumed render may differ from a continuous one. The
+// planner never picks it.
+enum
+{
+    REVERB_KERNEL_FUSED,    // all stages per sample
+    REVERB_KERNEL_STAGED,   // one stage at a time over a block
+    REVERB_KERNEL_THREADED, // staged, half of the combs on a helper thread
+    REVERB_KERNEL_SIMD,     // staged with the vector block filters
+    REVERB_KERNEL_SCAN,     // simd, allpass line recursion as a vector scan
+    REVERB_NUM_KERNELS
+};
+
+// Reverb topologies, all behind the same three allpasses
+enum
+{
+    REVERB_ENGINE_SCHROEDER, // four feed forward combs, see REVERB_KERNEL_*
+    REVERB_ENGINE_COMB8,     // eight damped feedback combs, comb8.h
+    REVERB_ENGINE_VELVET,    // sparse velvet noise convolution, velvet.h
+    REVERB_NUM_ENGINES
+};
+
+#define REVERB_COMB8_LANES 8
+#define REVERB_VELVET_TAPS 24
+
+// NOTE: and TODO: currently only wav 16 bit is supported
+#define MAX_SMP_VAL (1.f * 32767.f)
+#define MIN_SMP_VAL (-1.f * 32767.f)
+
+static inline float hardClip(float x)
+{
+    return (x > MAX_SMP_VAL) ? MAX_SMP_VAL : (x < MIN_SMP_VAL) ? MIN_SMP_VAL : x;
+}
+
+typedef struct reverb
+{
+    // Buffer
+    float* fAP[REVERB_NUM_AP];
+    float* fFFCF[REVERB_NUM_FFCF];
+
+    // Index to access the buffer
+    int iAP[REVERB_NUM_AP];
+    int iFFCF[REVERB_NUM_FFCF];
+
+    // Current delay lengths, scaled by modReverb
+    int iAP_BUFFER_SIZE[REVERB_NUM_AP];
+    int iFFCF_BUFFER_SIZE[REVERB_NUM_FFCF];
+
+    float dryWet;    // 0...100 percent
+    float modReverb; // 0...1
+
+    // The AP/FFCF network runs at fs/decimation (1, 2 or 4) with delay
+    // lengths and delay line memory scaled down accordingly
+    int decimation;
+    int iMaxBufferSize;
+    halfband_dec_t dec[2];
+    halfband_int_t interp[2];
+    float fQueue[REVERB_MAX_DECIMATION]; // interpolated wet samples not yet output
+    int iQueueCount;
+
+    int kernel;            // REVERB_KERNEL_*
+    struct worker* worker; // helper thread of REVERB_KERNEL_THREADED
+
+    struct telemetry* telemetry; // NULL unless enabled
+
+    struct rt_arena* arena; // where all of the above lives, NULL for the heap
+
+    // REVERB_ENGINE_COMB8, one interleaved line for all lanes
+    int engine;               // REVERB_ENGINE_*
+    float* fComb8;            // (iComb8Mask + 1) rows of REVERB_COMB8_LANES
+    int iComb8Mask;
+    int iComb8Write;
+    int iComb8Delay[REVERB_COMB8_LANES];
+    float fComb8Filter[REVERB_COMB8_LANES]; // lowpass state in the loop
+
+    // REVERB_ENGINE_VELVET, input history stored twice in a row
+    float* fVelvet;           // 2 * (iVelvetMask + 1) samples
+    int iVelvetMask;
+    int iVelvetWrite;
+    int iVelvetDelay[REVERB_VELVET_TAPS];
+    float fVelvetGain[REVERB_VELVET_TAPS];
+} reverb_t;
+
+bool reverb_setup(reverb_t* rv);
+bool reverb_setup_decimated(reverb_t* rv, int decimation);
+void reverb_cleanup(reverb_t* rv);
+
+// Same with the delay lines, telemetry and the lines of a later
+// reverb_set_engine() taken from an arena (rt.h), nothing is allocated
+// after this. The arena needs reverb_memory_size() bytes and outlives rv.
+bool reverb_setup_arena(reverb_t* rv, int decimation, struct rt_arena* arena);
+size_t reverb_memory_size(int decimation, int engine);
+
+// Back to silence without reallocating, e.g. to reuse a pooled instance.
+// Clears the part of the delay lines in use by the current delay lengths.
+void reverb_reset(reverb_t* rv);
+
+// Select the network implementation, false if it is not available here
+bool reverb_set_kernel(reverb_t* rv, int kernel);
+const char* reverb_kernel_name(int kernel);
+
+// Select the topology, the comb8 / velvet lines are allocated on first use.
+// The kernel only applies to REVERB_ENGINE_SCHROEDER.
+bool reverb_set_engine(reverb_t* rv, int engine);
+const char* reverb_engine_name(int engine);
+
+// Per block clip counts, peak/RMS and delay line energy, see telemetry.h.
+// Enabled engines run the staged kernel to see every stage output.
+// Counters survive reverb_reset().
+bool reverb_enable_telemetry(reverb_t* rv, bool enable);
+
+// Sum of squares over the used part of the delay lines of the engine,
+// what the wet output can still be made of once the input is silent
+double reverb_line_energy(const reverb_t* rv);
+// Same with the largest magnitude in those lines
+void reverb_line_peak_energy(const reverb_t* rv, float* peak, double* energy);
+
+// Scale all delay lengths by expf(2.9 * modReverb), modReverb in 0...1.
+// Safe while processing: nothing is reallocated, line regions a longer
+// delay brings into use start out silent.
+void reverb_set_mod(reverb_t* rv, float modReverb);
+
+float processAP(float x, float g, float* state, int* i, int iBufsize);
+float processFBCF(float x, float g, float* state, int* i, int iBufsize);
+float processFFCF(float x, float g, float* state, int* i, int iBufsize);
+float processMM(float x1, float x2, float x3, float x4);
+
+// n samples at once, same results as the per sample filters (simd.h)
+void processAPBlock(const float* x, float* y, int n, float g, float* state, int* i, int iBufsize);
+void processFBCFBlock(const float* x, float* y, int n, float g, float* state, int* i, int iBufsize);
+void processFFCFBlock(const float* x, float* y, int n, float g, float* state, int* i, int iBufsize);
+// processAPBlock() with the line recursion in vectors too, rounds differently
+void processAPBlockScan(const float* x, float* y, int n, float g, float* state, int* i, int iBufsize);
+
+// y = hardClip(hardClip(hardClip(c0 + c1) + c2) + c3)
+void processCombSum(const float* const comb[REVERB_NUM_FFCF], float* y, int n);
+
+// Run n samples through the network, writing the wet signal only
+void reverb_process_block(reverb_t* rv, const float* in, float* wet, int n);
+
+// out = dryWet/100 * wet + (1 - dryWet/100) * in
+void reverb_mix_block(float dryWet, const float* in, const float* wet, float* out, int n);
+// Same with one dryWet per sample
+void reverb_mix_block_ramp(const float* dryWet, const float* in, const float* wet, float* out, int n);
+
+// Snapshot of the complete engine state: parameters, delay lengths, read /
+// write indices and the used part of every delay line. Loading a snapshot
+// into a set up reverb_t continues processing exactly where it was saved.
+// Both return true on success.
+bool reverb_save_state(const reverb_t* rv, FILE* f);
+bool reverb_load_state(reverb_t* rv, FILE* f);
+
+// Interleaved 16 bit little endian <-> mono float, in the range of int16
+void reverb_read_s16(const uint8_t* in, float* out, int frames, int channels);
+void reverb_write_s16(const float* in, int16_t* out, int frames, int channels);
+// Separate left / right, averaged for mono output
+void reverb_write_s16_stereo(const float* left, const float* right, int16_t* out, int frames, int channels);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
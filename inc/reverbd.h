@@ -0,0 +1,118 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Reverb daemon: keeps reverb engines warm and processes audio that local
+  clients place in POSIX shared memory. The Unix socket only carries small
+  control messages, blocks are processed in place in the shared ring.
+
+  Client usage:
+
+    void* c = reverbd_open("/tmp/reverb.sock", 1024, 30.f, 20.f, 1);
+    while(more)
+    {
+        float* block = reverbd_get_block(c);  // waits for a free slot
+        ... write up to 1024 mono samples to block ...
+        uint32_t seq = reverbd_submit(c, frames);
+        reverbd_wait(c, seq);                 // block now holds the output
+    }
+    reverbd_close(c);
+
+  Submitting several blocks before waiting keeps the daemon busy while
+  the client prepares the next one.
+*/
+
+#ifndef REVERBD_H
+#define REVERBD_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REVERBD_MAGIC        0x52564244 // "RVBD"
+#define REVERBD_VERSION      1
+#define REVERBD_SLOTS        4
+#define REVERBD_MAX_FRAMES   16384
+
+enum
+{
+    REVERBD_OPEN = 1, // client -> daemon: map shm_name, set up a session
+    REVERBD_KICK,     // client -> daemon: new slots up to head
+    REVERBD_CLOSE,    // client -> daemon: end of session
+    REVERBD_OK,       // daemon -> client: session ready
+    REVERBD_DONE,     // daemon -> client: slots processed up to done
+    REVERBD_ERROR     // daemon -> client: request failed
+};
+
+typedef struct reverbd_msg
+{
+    uint32_t type;
+    uint32_t seq;       // KICK: head, DONE: done
+    float dryWet;       // OPEN: 0...100 percent
+    float modReverb;    // OPEN: 0...100 percent
+    int32_t decimation; // OPEN: 1, 2 or 4
+    char shm_name[52];
+} reverbd_msg_t;
+
+typedef struct reverbd_slot
+{
+    uint32_t frames;    // valid samples in this slot
+    uint32_t pad[15];   // keep samples cache line aligned
+    float samples[];    // slot_frames mono samples, int16 range
+} reverbd_slot_t;
+
+// Header of the shared memory segment, followed by the slots
+typedef struct reverbd_ring
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t slot_frames;
+    uint32_t head;      // slots submitted, written by the client
+    uint32_t pad0[15];
+    uint32_t done;      // slots processed, written by the daemon
+    uint32_t pad1[15];
+} reverbd_ring_t;
+
+static inline size_t reverbd_slot_size(uint32_t slot_frames)
+{
+    return sizeof(reverbd_slot_t) + slot_frames * sizeof(float);
+}
+
+static inline size_t reverbd_ring_size(uint32_t slots, uint32_t slot_frames)
+{
+    return sizeof(reverbd_ring_t) + slots * reverbd_slot_size(slot_frames);
+}
+
+// slots and slot_frames are each side's own copy, never read back from the
+// ring: the other process can rewrite the shared header at any time
+static inline reverbd_slot_t* reverbd_ring_slot(reverbd_ring_t* ring, uint32_t slots, uint32_t slot_frames, uint32_t seq)
+{
+    return (reverbd_slot_t*)((char*)(ring + 1) + (seq % slots) * reverbd_slot_size(slot_frames));
+}
+
+// Daemon, runs until SIGINT / SIGTERM. pool engines are set up up front.
+// With metrics != NULL telemetry of all engines goes to that file every second.
+int reverbd_run(const char* socket_path, int pool, const char* metrics, FILE* info);
+
+// Client library
+void* reverbd_open(const char* socket_path, int slot_frames, float dryWet, float modReverb, int decimation);
+float* reverbd_get_block(void* obj);
+uint32_t reverbd_submit(void* obj, int frames);
+int reverbd_wait(void* obj, uint32_t seq);
+void reverbd_close(void* obj);
+
+// Load generator: clients threads, each rendering clips short clips through
+// the daemon, one session per clip
+int reverbd_loadgen(const char* socket_path, int clients, int clips, FILE* info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
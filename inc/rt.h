@@ -0,0 +1,87 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Real-time support: one arena for all engine memory, taken at init,
+  zeroed, prefaulted and locked so the audio path never allocates or page
+  faults, a thread with SCHED_FIFO and an optional CPU to run it on, and
+  a debug guard against malloc on the audio thread.
+
+    rt_arena_t arena;
+    rt_arena_init(&arena, reverb_memory_size(decimation, engine));
+    reverb_setup_arena(&rv, decimation, &arena);
+    rt_arena_lock(&arena);
+
+  Built with RT_MALLOC_GUARD (make debug) malloc, calloc, realloc and free
+  abort the process while the calling thread is between rt_guard_enter()
+  and rt_guard_leave(). Without it both are no-ops.
+*/
+
+#ifndef RT_H
+#define RT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RT_ARENA_ALIGN 64 // every block starts on a cache line
+
+typedef struct rt_arena
+{
+    uint8_t* base;
+    void* mem;   // as allocated, base may be above it
+    size_t size;
+    size_t used;
+    bool locked; // mlock succeeded
+} rt_arena_t;
+
+// size bytes, blocks taken from it are rounded up by rt_arena_bytes()
+bool rt_arena_init(rt_arena_t* a, size_t size);
+void rt_arena_free(rt_arena_t* a);
+
+// Zeroed block, NULL when the arena is full. Blocks are not freed one by one.
+void* rt_arena_alloc(rt_arena_t* a, size_t size);
+
+// Space a block of size bytes takes in an arena
+static inline size_t rt_arena_bytes(size_t size)
+{
+    return (size + RT_ARENA_ALIGN - 1) & ~(size_t)(RT_ARENA_ALIGN - 1);
+}
+
+// Write every page and mlock the arena. False if it could not be locked,
+// the pages are resident anyway until the system swaps them out.
+bool rt_arena_lock(rt_arena_t* a);
+
+// calloc / free, or the arena when a != NULL (rt_free() is a no-op then)
+void* rt_calloc(rt_arena_t* a, size_t count, size_t size);
+void rt_free(rt_arena_t* a, void* p);
+
+// Lock everything mapped now, e.g. stdio buffers and code. Later mappings
+// are not locked, allocate and lock what the audio path needs before.
+bool rt_lock_process(void);
+
+// Run fn(arg) on a new thread with SCHED_FIFO at priority (1...99) and
+// pinned to cpu (-1 for any), and wait for it. Without the permission
+// for either it warns on info and runs with what it got. The first
+// RT_STACK_PREFAULT bytes of its stack are touched before fn is called.
+// While waiting the calling thread runs idle(arg) every RT_IDLE_PERIOD
+// seconds, for the file I/O fn must not do itself. idle may be NULL.
+#define RT_STACK_PREFAULT (256 * 1024)
+#define RT_IDLE_PERIOD    1
+bool rt_thread_run(int priority, int cpu, void* (*fn)(void*), void (*idle)(void*), void* arg, FILE* info);
+
+// Mark the audio path of the calling thread, see RT_MALLOC_GUARD above
+void rt_guard_enter(void);
+void rt_guard_leave(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,222 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Thin float vector layer on GCC/Clang vector extensions, shared by the x86
+  tools and the Bela project. vf_t has the native width: 8 lanes with AVX,
+  4 with SSE or NEON. Arithmetic uses the plain operators, the functions
+  below cover what the operators don't.
+
+    vf_t x = vf_loadu(&in[s]);
+    x = vf_clamp(vf_madd(g, x, vf_loadu(&line[i])), lo, hi);
+    vf_storeu(&out[s], x);
+
+  vf_madd() rounds after the multiply like the scalar code does, so
+  vector and scalar kernels give identical results. ARMv7 NEON always
+  flushes denormals to zero, there they agree down to FLT_MIN only, unless
+  the scalar code runs with flush to zero as well. vf_fma() rounds once
+  and is only fused where the hardware has it. Build with
+  -ffp-contract=off to keep the compiler from fusing on its own.
+
+  Define SIMD_GENERIC to get the portable fallback on any target.
+*/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(SIMD_GENERIC)
+#if defined(__AVX__)
+#define SIMD_AVX
+#include <immintrin.h>
+#elif defined(__SSE__)
+#define SIMD_SSE
+#include <xmmintrin.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#if defined(SIMD_AVX)
+#define SIMD_LANES 8
+#else
+#define SIMD_LANES 4
+#endif
+
+#define SIMD_ALIGN (SIMD_LANES * 4) // bytes, for vf_load / vf_store
+
+typedef float vf_t __attribute__((vector_size(SIMD_ALIGN)));
+typedef int32_t vi_t __attribute__((vector_size(SIMD_ALIGN)));
+
+static inline vf_t vf_set1(float x)
+{
+#if defined(SIMD_AVX)
+    return (vf_t)_mm256_set1_ps(x);
+#elif defined(SIMD_SSE)
+    return (vf_t)_mm_set1_ps(x);
+#elif defined(SIMD_NEON)
+    return (vf_t)vdupq_n_f32(x);
+#else
+    vf_t v;
+    for(int l = 0; l < SIMD_LANES; l++)
+        v[l] = x;
+    return v;
+#endif
+}
+
+// p aligned to SIMD_ALIGN
+static inline vf_t vf_load(const float* p)
+{
+    return *(const vf_t*)p;
+}
+
+static inline void vf_store(float* p, vf_t v)
+{
+    *(vf_t*)p = v;
+}
+
+static inline vf_t vf_loadu(const float* p)
+{
+    vf_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void vf_storeu(float* p, vf_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline vf_t vf_min(vf_t a, vf_t b)
+{
+#if defined(SIMD_AVX)
+    return (vf_t)_mm256_min_ps((__m256)a, (__m256)b);
+#elif defined(SIMD_SSE)
+    return (vf_t)_mm_min_ps((__m128)a, (__m128)b);
+#elif defined(SIMD_NEON)
+    return (vf_t)vminq_f32((float32x4_t)a, (float32x4_t)b);
+#else
+    vi_t lt = (vi_t)(a < b);
+    return (vf_t)((lt & (vi_t)a) | (~lt & (vi_t)b));
+#endif
+}
+
+static inline vf_t vf_max(vf_t a, vf_t b)
+{
+#if defined(SIMD_AVX)
+    return (vf_t)_mm256_max_ps((__m256)a, (__m256)b);
+#elif defined(SIMD_SSE)
+    return (vf_t)_mm_max_ps((__m128)a, (__m128)b);
+#elif defined(SIMD_NEON)
+    return (vf_t)vmaxq_f32((float32x4_t)a, (float32x4_t)b);
+#else
+    vi_t gt = (vi_t)(a > b);
+    return (vf_t)((gt & (vi_t)a) | (~gt & (vi_t)b));
+#endif
+}
+
+// Saturate to lo...hi, the vector hardClip()
+static inline vf_t vf_clamp(vf_t x, vf_t lo, vf_t hi)
+{
+    return vf_min(vf_max(x, lo), hi);
+}
+
+static inline vf_t vf_abs(vf_t x)
+{
+    vi_t mask;
+    for(int l = 0; l < SIMD_LANES; l++)
+        mask[l] = 0x7fffffff;
+    return (vf_t)((vi_t)x & mask);
+}
+
+// a*b + c with the product rounded first, the same as scalar code
+static inline vf_t vf_madd(vf_t a, vf_t b, vf_t c)
+{
+#if defined(SIMD_NEON) && !defined(__aarch64__)
+    // ARMv7 VMLA is chained, not fused
+    return (vf_t)vmlaq_f32((float32x4_t)c, (float32x4_t)a, (float32x4_t)b);
+#else
+    return a * b + c;
+#endif
+}
+
+// a*b + c rounded once
+static inline vf_t vf_fma(vf_t a, vf_t b, vf_t c)
+{
+#if defined(SIMD_AVX) && defined(__FMA__)
+    return (vf_t)_mm256_fmadd_ps((__m256)a, (__m256)b, (__m256)c);
+#elif defined(SIMD_SSE) && defined(__FMA__)
+    return (vf_t)_mm_fmadd_ps((__m128)a, (__m128)b, (__m128)c);
+#elif defined(SIMD_NEON) && defined(__ARM_FEATURE_FMA)
+    return (vf_t)vfmaq_f32((float32x4_t)c, (float32x4_t)a, (float32x4_t)b);
+#else
+    vf_t r;
+    for(int l = 0; l < SIMD_LANES; l++)
+        r[l] = fmaf(a[l], b[l], c[l]);
+    return r;
+#endif
+}
+
+// Lanes move up by k, zeros shift in: r[l] = x[l - k]
+static inline vf_t vf_shift_up(vf_t x, int k)
+{
+#if defined(SIMD_AVX)
+    // Rotate within the 128 bit halves, then take the lanes that wrapped
+    // from the halves moved up by one (zero, low half of x)
+    const __m256 t = _mm256_permute2f128_ps((__m256)x, (__m256)x, 0x08);
+    switch(k)
+    {
+    case 1: return (vf_t)_mm256_blend_ps(_mm256_permute_ps((__m256)x, 0x93), _mm256_permute_ps(t, 0x93), 0x11);
+    case 2: return (vf_t)_mm256_blend_ps(_mm256_permute_ps((__m256)x, 0x4e), _mm256_permute_ps(t, 0x4e), 0x33);
+    case 3: return (vf_t)_mm256_blend_ps(_mm256_permute_ps((__m256)x, 0x39), _mm256_permute_ps(t, 0x39), 0x77);
+    case 4: return (vf_t)t;
+    }
+#elif defined(SIMD_SSE) && defined(__SSE2__)
+    switch(k)
+    {
+    case 1: return (vf_t)_mm_slli_si128((__m128i)x, 4);
+    case 2: return (vf_t)_mm_slli_si128((__m128i)x, 8);
+    case 3: return (vf_t)_mm_slli_si128((__m128i)x, 12);
+    }
+#elif defined(SIMD_NEON)
+    const float32x4_t zero = vdupq_n_f32(0.f);
+    switch(k)
+    {
+    case 1: return (vf_t)vextq_f32(zero, (float32x4_t)x, 3);
+    case 2: return (vf_t)vextq_f32(zero, (float32x4_t)x, 2);
+    case 3: return (vf_t)vextq_f32(zero, (float32x4_t)x, 1);
+    }
+#endif
+    vf_t r = vf_set1(0.f);
+    for(int l = k; l < SIMD_LANES; l++)
+        r[l] = x[l - k];
+    return r;
+}
+
+// Sum of all lanes
+static inline float vf_hsum(vf_t x)
+{
+    float s = 0.f;
+    for(int l = 0; l < SIMD_LANES; l++)
+        s += x[l];
+    return s;
+}
+
+static inline float vf_hmax(vf_t x)
+{
+    float m = x[0];
+    for(int l = 1; l < SIMD_LANES; l++)
+        m = (x[l] > m) ? x[l] : m;
+    return m;
+}
+
+#endif
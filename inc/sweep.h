@@ -0,0 +1,34 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Parameter sweep rendering: many dryWet / modReverb variants of one
+  input from a single pass over the input file.
+*/
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SWEEP_MAX_VALUES 32
+
+// grid is "<dryWet list>:<modReverb list>", e.g. "20,40,60:0,50", all in
+// percent. Every combination is rendered to its own file, named after
+// outfile with "_dw<dryWet>_mod<modReverb>" inserted before ".wav", so a
+// value listed twice in either list is rejected.
+// All networks run at fs/decimation. Returns 0 on success.
+int sweep_run(void* wavIn, int sample_rate, int bits_per_sample, int channels, int decimation,
+              const char* outfile, const char* grid, FILE* info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
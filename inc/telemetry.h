@@ -0,0 +1,81 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Signal telemetry of one reverb engine: how often each stage runs into
+  hardClip(), peak and RMS of input and wet signal, and the energy left in
+  the delay lines. The audio thread accumulates per block and publishes
+  through a seqlock, readers on other threads never block it.
+
+    reverb_enable_telemetry(&rv, true);
+    ...                                      // audio thread processes
+    telemetry_stats_t st;
+    telemetry_read(rv.telemetry, &st);       // any thread
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum
+{
+    TELEMETRY_AP1,
+    TELEMETRY_AP2,
+    TELEMETRY_AP3,
+    TELEMETRY_FFCF1,
+    TELEMETRY_FFCF2,
+    TELEMETRY_FFCF3,
+    TELEMETRY_FFCF4,
+    TELEMETRY_COMBS, // sum of the comb bank
+    TELEMETRY_WET,   // wet output, after interpolation if decimated
+    TELEMETRY_NUM_STAGES
+};
+
+typedef struct telemetry_stats
+{
+    uint64_t blocks;
+    uint64_t frames;
+    uint64_t clips[TELEMETRY_NUM_STAGES]; // samples at the rail, since enabled
+    float peakIn;                         // last block
+    float peakWet;
+    float rmsIn;
+    float rmsWet;
+    double lineEnergy;                    // sum of squares over all delay lines
+} telemetry_stats_t;
+
+typedef struct telemetry
+{
+    uint32_t seq;            // odd while the audio thread writes pub
+    telemetry_stats_t pub;   // published copy
+    telemetry_stats_t cur;   // accumulated by the audio thread
+} telemetry_t;
+
+// Block reductions, 8 lanes wide so the compiler vectorizes them
+uint32_t telemetry_clips(const float* x, int n);
+void telemetry_peak_energy(const float* x, int n, float* peak, double* energy);
+
+// Audio thread: copy cur to pub
+void telemetry_publish(telemetry_t* tm);
+
+// Any thread: consistent copy of the last published stats
+void telemetry_read(const telemetry_t* tm, telemetry_stats_t* st);
+
+// Add counters, keep the larger gauges, e.g. over a pool of engines
+void telemetry_merge(telemetry_stats_t* total, const telemetry_stats_t* st);
+
+// Prometheus text format, replaced atomically. Returns false on error.
+bool telemetry_write_metrics(const char* path, const telemetry_stats_t* st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
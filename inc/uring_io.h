@@ -0,0 +1,56 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Sequential file I/O over io_uring for the WAV reader and writer.
+  URING_DEPTH aligned blocks of URING_BLOCK bytes are registered with the
+  ring and kept in flight: read ahead of the consumer, written behind the
+  producer. The file is opened with O_DIRECT when the file system takes it,
+  then the page cache is bypassed and nothing is copied through the kernel.
+
+  Linux only, the open functions return NULL wherever the ring can't be
+  set up (other systems, io_uring disabled, a pipe) and the caller keeps
+  its stdio path.
+*/
+
+#ifndef URING_IO_H
+#define URING_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define URING_DEPTH 8            // blocks in flight per file
+#define URING_BLOCK (512 * 1024) // bytes per request, 4 MB registered per file
+#define URING_ALIGN 4096         // O_DIRECT offset, size and memory alignment
+
+typedef struct uring_file uring_file_t;
+
+// Read length bytes of filename from offset on, NULL if io_uring isn't
+// available for it
+uring_file_t* uring_read_open(const char* filename, uint64_t offset, uint64_t length);
+// Up to length bytes, fewer only at the end of the range or the file
+size_t uring_read(uring_file_t* f, void* data, size_t length);
+
+// Append to filename from offset on, what is in the file before offset is
+// kept and the file is cut at the last byte written on close
+uring_file_t* uring_write_open(const char* filename, uint64_t offset);
+// False once a write failed
+bool uring_write(uring_file_t* f, const void* data, size_t length);
+
+// Waits for the writes still in flight, false if any of them failed
+bool uring_close(uring_file_t* f);
+
+// True when the file is open with O_DIRECT
+bool uring_direct(const uring_file_t* f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
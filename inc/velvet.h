@@ -0,0 +1,54 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Tail of REVERB_ENGINE_VELVET: the allpass output is convolved directly
+  with a velvet noise response, REVERB_VELVET_TAPS sparse +-1 pulses with
+  exponentially decaying gains. One pulse sits at a random position in
+  each grid cell, the response is split into segments that get sparser
+  towards the end where the decay masks the lower density:
+
+    | 10 pulses | 7 pulses | 4 pulses | 3 pulses |
+
+  The cost is one multiply-add per tap and sample, whatever the length of
+  the response, and the tap table is a few hundred bytes. The input
+  history is stored twice, one copy behind the other, so the samples a
+  tap reads for a block are always contiguous and a vector of output
+  samples is one unaligned load per tap. A few output vectors are summed
+  over all taps at once to keep them in registers.
+*/
+
+#ifndef VELVET_H
+#define VELVET_H
+
+#include "reverb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Allocate the history for the longest response at rv->decimation
+bool velvet_setup(reverb_t* rv);
+void velvet_cleanup(reverb_t* rv);
+// Bytes velvet_setup() takes from an arena
+size_t velvet_memory_size(int decimation);
+
+// Pulse positions and gains from rv->modReverb, same pattern scaled
+void velvet_set_mod(reverb_t* rv);
+void velvet_reset(reverb_t* rv);
+
+// n up to the block length the history was sized for (VELVET_MAX_BLOCK)
+void velvet_process(reverb_t* rv, const float* in, float* out, int n);
+
+// Peak and sum of squares of the history the taps still reach
+void velvet_peak_energy(const reverb_t* rv, float* peak, double* energy);
+
+#define VELVET_MAX_BLOCK 1024
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,14 +19,26 @@
 #ifndef WAVREADER_H
 #define WAVREADER_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// How the data chunk is read, the header always goes through stdio
+enum {
+	WAV_IO_STDIO,
+	WAV_IO_URING // io_uring with O_DIRECT where possible, falls back to stdio
+};
+
 void* wav_read_open(const char *filename);
+void* wav_read_open_io(const char *filename, int io);
 void wav_read_close(void* obj);
 
-int wav_get_header(void* obj, int* format, int* channels, int* sample_rate, int* bits_per_sample, unsigned int* data_length);
+// The backend in use, e.g. "stdio" or "io_uring O_DIRECT"
+const char* wav_read_io_name(void* obj);
+
+int wav_get_header(void* obj, int* format, int* channels, int* sample_rate, int* bits_per_sample, uint64_t* data_length);
 int wav_read_data(void* obj, unsigned char* data, unsigned int length);
 
 #ifdef __cplusplus
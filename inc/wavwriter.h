@@ -24,7 +24,12 @@ extern "C" {
 #endif
 
 void* wav_write_open(const char *filename, int sample_rate, int bits_per_sample, int channels);
-void wav_write_close(void* obj);
+// io is one of WAV_IO_* from wavreader.h
+void* wav_write_open_io(const char *filename, int sample_rate, int bits_per_sample, int channels, int io);
+// 0 on success, -1 if any of the data or the header could not be written
+int wav_write_close(void* obj);
+
+const char* wav_write_io_name(void* obj);
 
 void wav_write_data(void* obj, const unsigned char* data, int length);
 
@@ -0,0 +1,32 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  A single helper thread that runs one task at a time, used to split the
+  work of one reverb block across two cores.
+*/
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct worker worker_t;
+
+// NULL if threads are not available
+worker_t* worker_create(void);
+void worker_destroy(worker_t* w);
+
+// Run fn(arg) on the helper thread, worker_wait() blocks until it returned
+void worker_start(worker_t* w, void (*fn)(void*), void* arg);
+void worker_wait(worker_t* w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
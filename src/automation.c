@@ -0,0 +1,217 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Parameter automation, see automation.h
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "automation.h"
+#include "rt.h"
+
+static const char* const paramNames[AUTOMATION_NUM_PARAMS] = { "dryWet", "modReverb" };
+
+static bool addPoint(automation_lane_t* lane, int64_t frame, float value)
+{
+    // Grow by doubling, num is a power of 2 whenever the array is full
+    if((lane->num & (lane->num - 1)) == 0)
+    {
+        const int size = lane->num ? 2 * lane->num : 1;
+        automation_point_t* p = (automation_point_t*)realloc(lane->points, size * sizeof(*p));
+        if(!p)
+            return false;
+        lane->points = p;
+    }
+
+    lane->points[lane->num].frame = frame;
+    lane->points[lane->num].value = value;
+    lane->num++;
+
+    return true;
+}
+
+bool automation_load(automation_t* a, const char* path, int sample_rate)
+{
+    char line[256];
+
+    memset(a, 0, sizeof(*a));
+
+    FILE* f = fopen(path, "r");
+    if(!f)
+    {
+        fprintf(stderr, "Unable to open automation %s\n", path);
+        return false;
+    }
+
+    while(fgets(line, sizeof(line), f))
+    {
+        double seconds;
+        char name[32];
+        float value;
+        int param;
+        char* p = strchr(line, '#');
+        if(p)
+            *p = '\0';
+
+        int fields = sscanf(line, "%lf %31s %f", &seconds, name, &value);
+        if(fields <= 0)
+            continue;
+
+        for(param = 0; fields == 3 && param < AUTOMATION_NUM_PARAMS; param++)
+        {
+            if(!strcmp(name, paramNames[param]))
+                break;
+        }
+
+        automation_lane_t* lane = &a->lane[param];
+        const int64_t frame = (int64_t)(seconds * sample_rate + 0.5);
+
+        if(fields != 3 || param == AUTOMATION_NUM_PARAMS || seconds < 0.0 || value < 0.f || value > 100.f ||
+           (lane->num && frame < lane->points[lane->num - 1].frame))
+        {
+            fprintf(stderr, "Bad breakpoint in %s: %s\n", path, line);
+            fclose(f);
+            automation_cleanup(a);
+            return false;
+        }
+
+        if(!addPoint(lane, frame, value))
+        {
+            fprintf(stderr, "Unable to allocate memory for automation\n");
+            fclose(f);
+            automation_cleanup(a);
+            return false;
+        }
+    }
+    fclose(f);
+
+    if(!a->lane[AUTOMATION_DRYWET].num && !a->lane[AUTOMATION_MOD].num)
+    {
+        fprintf(stderr, "No breakpoints in %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+void automation_cleanup(automation_t* a)
+{
+    for(int k = 0; k < AUTOMATION_NUM_PARAMS; k++)
+    {
+        rt_free(a->arena, a->lane[k].points);
+        a->lane[k].points = NULL;
+        a->lane[k].num = 0;
+    }
+}
+
+size_t automation_memory_size(const automation_t* a)
+{
+    size_t size = 0;
+
+    for(int k = 0; k < AUTOMATION_NUM_PARAMS; k++)
+        size += rt_arena_bytes(a->lane[k].num * sizeof(automation_point_t));
+
+    return size;
+}
+
+bool automation_move_to_arena(automation_t* a, rt_arena_t* arena)
+{
+    automation_point_t* points[AUTOMATION_NUM_PARAMS] = { NULL };
+
+    for(int k = 0; k < AUTOMATION_NUM_PARAMS; k++)
+    {
+        if(!a->lane[k].num)
+            continue;
+        points[k] = (automation_point_t*)rt_arena_alloc(arena, a->lane[k].num * sizeof(automation_point_t));
+        if(!points[k])
+            return false;
+        memcpy(points[k], a->lane[k].points, a->lane[k].num * sizeof(automation_point_t));
+    }
+
+    for(int k = 0; k < AUTOMATION_NUM_PARAMS; k++)
+    {
+        rt_free(a->arena, a->lane[k].points);
+        a->lane[k].points = points[k];
+    }
+    a->arena = arena;
+
+    return true;
+}
+
+int automation_points(const automation_t* a, int param)
+{
+    return a->lane[param].num;
+}
+
+float automation_value(automation_t* a, int param, int64_t frame)
+{
+    automation_lane_t* lane = &a->lane[param];
+    const automation_point_t* p = lane->points;
+
+    while(lane->cursor < lane->num && p[lane->cursor].frame <= frame)
+        lane->cursor++;
+
+    if(lane->cursor == 0)
+        return p[0].value;
+    if(lane->cursor == lane->num)
+        return p[lane->num - 1].value;
+
+    // p0.frame <= frame < p1.frame
+    const automation_point_t* p0 = &p[lane->cursor - 1];
+    const automation_point_t* p1 = &p[lane->cursor];
+    return p0->value + (float)((double)(p1->value - p0->value) * (frame - p0->frame) / (p1->frame - p0->frame));
+}
+
+// True if the segment of pos is flat up to pos + n - 1
+static bool isFlat(automation_t* a, int param, int64_t pos, int n, float* value)
+{
+    const automation_lane_t* lane = &a->lane[param];
+
+    *value = automation_value(a, param, pos);
+
+    if(lane->cursor == lane->num)
+        return true;
+
+    const automation_point_t* p1 = &lane->points[lane->cursor];
+    const bool flat = (lane->cursor == 0) || (lane->points[lane->cursor - 1].value == p1->value);
+
+    return flat && pos + n - 1 <= p1->frame;
+}
+
+bool automation_ramp(automation_t* a, int param, int64_t pos, int n, float* values, float* value)
+{
+    if(!a->lane[param].num || isFlat(a, param, pos, n, value))
+        return false;
+
+    for(int s = 0; s < n; s++)
+        values[s] = automation_value(a, param, pos + s);
+
+    return true;
+}
+
+void automation_process_block(automation_t* a, reverb_t* rv, int64_t pos, const float* in, float* wet, int n)
+{
+    float mod;
+
+    if(!a->lane[AUTOMATION_MOD].num || isFlat(a, AUTOMATION_MOD, pos, n, &mod))
+    {
+        if(a->lane[AUTOMATION_MOD].num && mod/100.f != rv->modReverb)
+            reverb_set_mod(rv, mod/100.f);
+        reverb_process_block(rv, in, wet, n);
+        return;
+    }
+
+    for(int s = 0; s < n; s += AUTOMATION_CONTROL_BLOCK)
+    {
+        const int len = (n - s < AUTOMATION_CONTROL_BLOCK) ? n - s : AUTOMATION_CONTROL_BLOCK;
+
+        mod = automation_value(a, AUTOMATION_MOD, pos + s) / 100.f;
+        if(mod != rv->modReverb)
+            reverb_set_mod(rv, mod);
+        reverb_process_block(rv, &in[s], &wet[s], len);
+    }
+}
@@ -0,0 +1,450 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Synthetic benchmarks of the reverb engines.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "reverb.h"
+#include "wavreader.h"
+#include "wavwriter.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define BENCH_FSYNC
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_TSC
+#endif
+
+#define BENCH_SAMPLE_RATE 48000
+#define BENCH_SECONDS     10
+#define BENCH_BLOCK       4096
+#define BENCH_FFT_SIZE    4096
+#define BENCH_NUM_BANDS   10
+#define BENCH_REPEAT      5  // best of, the first pass also pays the page faults
+#define BENCH_IO_FRAMES   4096 // frames per wav_read_data / wav_write_data, as rendering
+#define BENCH_IO_REPEAT   3
+
+static const float fBandCenter[BENCH_NUM_BANDS] = {
+    31.5f, 63.f, 125.f, 250.f, 500.f, 1000.f, 2000.f, 4000.f, 8000.f, 16000.f
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Deterministic white noise in the int16 range used by the engine
+static void noise(float* x, int n)
+{
+    uint32_t seed = 12345;
+    for(int s = 0; s < n; s++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        x[s] = ((int32_t)(seed >> 8) - (1 << 23)) * (8000.f / (1 << 23));
+    }
+}
+
+// In place radix 2 FFT, n a power of 2
+static void fft(float* re, float* im, int n)
+{
+    for(int i = 1, j = 0; i < n; i++)
+    {
+        int bit = n >> 1;
+        for(; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if(i < j)
+        {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    for(int len = 2; len <= n; len <<= 1)
+    {
+        const double a = -2.0 * M_PI / len;
+        for(int i = 0; i < n; i += len)
+        {
+            for(int k = 0; k < len/2; k++)
+            {
+                const float wr = (float)cos(a*k), wi = (float)sin(a*k);
+                float* ur = &re[i+k];
+                float* ui = &im[i+k];
+                float* vr = &re[i+k+len/2];
+                float* vi = &im[i+k+len/2];
+                const float tr = *vr * wr - *vi * wi;
+                const float ti = *vr * wi + *vi * wr;
+                *vr = *ur - tr;
+                *vi = *ui - ti;
+                *ur += tr;
+                *ui += ti;
+            }
+        }
+    }
+}
+
+// Welch averaged power per octave band, in dB
+static void octaveBands(const float* x, int n, float* bands)
+{
+    float re[BENCH_FFT_SIZE], im[BENCH_FFT_SIZE];
+    double power[BENCH_NUM_BANDS] = { 0 };
+
+    for(int start = 0; start + BENCH_FFT_SIZE <= n; start += BENCH_FFT_SIZE/2)
+    {
+        for(int k = 0; k < BENCH_FFT_SIZE; k++)
+        {
+            const float w = 0.5f - 0.5f * cosf(2.f * (float)M_PI * k / BENCH_FFT_SIZE);
+            re[k] = x[start + k] * w;
+            im[k] = 0.f;
+        }
+
+        fft(re, im, BENCH_FFT_SIZE);
+
+        for(int k = 1; k < BENCH_FFT_SIZE/2; k++)
+        {
+            const float f = (float)k * BENCH_SAMPLE_RATE / BENCH_FFT_SIZE;
+            for(int b = 0; b < BENCH_NUM_BANDS; b++)
+            {
+                if(f >= fBandCenter[b] / sqrtf(2.f) && f < fBandCenter[b] * sqrtf(2.f))
+                    power[b] += (double)re[k]*re[k] + (double)im[k]*im[k];
+            }
+        }
+    }
+
+    for(int b = 0; b < BENCH_NUM_BANDS; b++)
+        bands[b] = 10.f * log10f((float)power[b] + 1e-20f);
+}
+
+// Best ns per sample over BENCH_REPEAT passes. With cycles != NULL also
+// time stamp counter ticks per sample of the same pass, 0 without a TSC.
+static double timeEngine(reverb_t* rv, const float* in, float* wet, int num, double* cycles)
+{
+    double best = 1e30;
+
+    if(cycles)
+        *cycles = 0.0;
+
+    for(int r = 0; r < BENCH_REPEAT; r++)
+    {
+#ifdef BENCH_TSC
+        const uint64_t c0 = __rdtsc();
+#endif
+        double t0 = now();
+        for(int s = 0; s < num; s += BENCH_BLOCK)
+        {
+            int n = (num - s < BENCH_BLOCK) ? num - s : BENCH_BLOCK;
+            reverb_process_block(rv, &in[s], &wet[s], n);
+        }
+        double t = (now() - t0) * 1e9 / num;
+        if(t < best)
+        {
+            best = t;
+#ifdef BENCH_TSC
+            if(cycles)
+                *cycles = (double)(__rdtsc() - c0) / num;
+#endif
+        }
+    }
+
+    return best;
+}
+
+// Full rate Schroeder kernels against the comb8 and velvet engines
+static bool benchEngines(float modReverb, const float* in, float* wet, int num, FILE* info)
+{
+    const int engines[] = { REVERB_ENGINE_SCHROEDER, REVERB_ENGINE_SCHROEDER, REVERB_ENGINE_SCHROEDER,
+                            REVERB_ENGINE_COMB8, REVERB_ENGINE_VELVET };
+    const int kernels[] = { REVERB_KERNEL_FUSED, REVERB_KERNEL_SIMD, REVERB_KERNEL_SCAN,
+                            REVERB_KERNEL_FUSED, REVERB_KERNEL_FUSED };
+    const int num_engines = (int)(sizeof(engines) / sizeof(engines[0]));
+    double ns[5];
+
+    fprintf(info, "\nengine     kernel  ns/sample  cycles/sample  relative\n");
+
+    for(int e = 0; e < num_engines; e++)
+    {
+        reverb_t rv;
+        if(!reverb_setup(&rv) || !reverb_set_engine(&rv, engines[e]) || !reverb_set_kernel(&rv, kernels[e]))
+        {
+            fprintf(stderr, "setup failed\n");
+            reverb_cleanup(&rv);
+            return false;
+        }
+        reverb_set_mod(&rv, modReverb);
+
+        double cycles;
+        ns[e] = timeEngine(&rv, in, wet, num, &cycles);
+        fprintf(info, "%-9s  %6s  %9.2f  %13.1f  %7.2fx\n", reverb_engine_name(engines[e]),
+                (engines[e] == REVERB_ENGINE_SCHROEDER) ? reverb_kernel_name(kernels[e]) : "-", ns[e], cycles, ns[e] / ns[0]);
+
+        reverb_cleanup(&rv);
+    }
+
+    return true;
+}
+
+int bench_run(float modReverb, FILE* info)
+{
+    const int decimations[] = { 1, 2, 4 };
+    const int num = BENCH_SECONDS * BENCH_SAMPLE_RATE;
+    float* in = (float*)malloc(num * sizeof(float));
+    float* wet = (float*)malloc(num * sizeof(float));
+    float bands[3][BENCH_NUM_BANDS];
+    double ns[3];
+
+    if(!in || !wet)
+    {
+        fprintf(stderr, "Unable to allocate memory for buffer\n");
+        free(in);
+        free(wet);
+        return 1;
+    }
+
+    noise(in, num);
+
+    fprintf(info, "bench: %d s white noise at %d Hz, modReverb = %.2f\n\n", BENCH_SECONDS, BENCH_SAMPLE_RATE, modReverb);
+    fprintf(info, "decimation  ns/sample  speedup  delay memory\n");
+
+    for(int d = 0; d < 3; d++)
+    {
+        reverb_t rv;
+        if(!reverb_setup_decimated(&rv, decimations[d]))
+        {
+            fprintf(stderr, "setup failed\n");
+            reverb_cleanup(&rv);
+            free(in);
+            free(wet);
+            return 1;
+        }
+        reverb_set_mod(&rv, modReverb);
+
+        ns[d] = timeEngine(&rv, in, wet, num, NULL);
+
+        octaveBands(wet, num, bands[d]);
+
+        fprintf(info, "%10d  %9.2f  %6.2fx  %9d kB\n", decimations[d], ns[d], ns[0] / ns[d],
+                (int)((REVERB_NUM_AP + REVERB_NUM_FFCF) * rv.iMaxBufferSize * sizeof(float) / 1024));
+
+        reverb_cleanup(&rv);
+    }
+
+    fprintf(info, "\noctave band [Hz]  full rate [dB]  fs/2 diff [dB]  fs/4 diff [dB]\n");
+    for(int b = 0; b < BENCH_NUM_BANDS; b++)
+    {
+        fprintf(info, "%16g  %14.1f  %14.1f  %14.1f\n", fBandCenter[b], bands[0][b],
+                bands[1][b] - bands[0][b], bands[2][b] - bands[0][b]);
+    }
+
+    const bool ok = benchEngines(modReverb, in, wet, num, info);
+
+    free(in);
+    free(wet);
+
+    return ok ? 0 : 1;
+}
+
+// Order dependent sum of the 64 bit words, the tail zero padded
+static uint64_t checksum(uint64_t h, const uint8_t* p, size_t n)
+{
+    for(size_t k = 0; k < n; k += 8)
+    {
+        uint64_t w = 0;
+        memcpy(&w, p + k, (n - k < 8) ? n - k : 8);
+        h = (h ^ w) * 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+// Write back and evict the cached pages of filename, a read pass then
+// comes from the device for either backend. Not root only, works on
+// clean pages.
+static void dropCache(const char* filename)
+{
+#ifdef BENCH_FSYNC
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return;
+    fsync(fd);
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    close(fd);
+#endif
+}
+
+// Seconds spent in wav_read_data over all of wavfile's data, got bytes
+static double readPass(const char* wavfile, int io, uint8_t* buf, size_t chunk, uint64_t* sum, uint64_t* got,
+                       const char** name)
+{
+    void* wav = wav_read_open_io(wavfile, io);
+    double t = 0.0;
+    int n;
+
+    if(!wav)
+        return -1.0;
+    *name = wav_read_io_name(wav);
+    *sum = 0;
+    *got = 0;
+
+    do
+    {
+        double t0 = now();
+        n = wav_read_data(wav, buf, (unsigned)chunk);
+        t += now() - t0;
+        if(n > 0)
+        {
+            *sum = checksum(*sum, buf, n);
+            *got += n;
+        }
+    } while(n > 0);
+
+    double t0 = now();
+    wav_read_close(wav);
+    t += now() - t0;
+
+    return t;
+}
+
+// Seconds to write bytes of buf repeated and have them on the device
+static double writePass(const char* outfile, int io, const uint8_t* buf, size_t chunk, uint64_t bytes,
+                        int sample_rate, int bits_per_sample, int channels, const char** name)
+{
+    double t0 = now();
+    void* wav = wav_write_open_io(outfile, sample_rate, bits_per_sample, channels, io);
+
+    if(!wav)
+        return -1.0;
+    *name = wav_write_io_name(wav);
+
+    for(uint64_t done = 0; done < bytes; done += chunk)
+        wav_write_data(wav, buf, (int)((bytes - done < chunk) ? bytes - done : chunk));
+    if(wav_write_close(wav) != 0)
+        return -1.0;
+
+#ifdef BENCH_FSYNC
+    // Buffered data counts once it is written back, like O_DIRECT data
+    int fd = open(outfile, O_RDONLY);
+    if(fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+
+    return now() - t0;
+}
+
+int bench_io(const char* wavfile, FILE* info)
+{
+    const int backends[] = { WAV_IO_STDIO, WAV_IO_URING };
+    int format, channels, sample_rate, bits_per_sample;
+    uint64_t bytes;
+    char outfile[1024];
+    bool ok = true;
+
+    void* wav = wav_read_open(wavfile);
+    if(!wav || !wav_get_header(wav, &format, &channels, &sample_rate, &bits_per_sample, &bytes))
+    {
+        fprintf(stderr, "Unable to open wav file %s\n", wavfile);
+        if(wav)
+            wav_read_close(wav);
+        return 1;
+    }
+    wav_read_close(wav);
+
+    // Next to the input, on the same file system
+    snprintf(outfile, sizeof(outfile), "%s.io_bench.wav", wavfile);
+
+    const size_t chunk = (size_t)BENCH_IO_FRAMES * channels * (bits_per_sample / 8);
+    uint8_t* buf = (uint8_t*)malloc(chunk);
+    uint8_t* pattern = (uint8_t*)malloc(chunk);
+    if(!buf || !pattern)
+    {
+        fprintf(stderr, "Unable to allocate memory for buffer\n");
+        free(buf);
+        free(pattern);
+        return 1;
+    }
+
+    uint32_t seed = 12345;
+    for(size_t k = 0; k < chunk; k++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        pattern[k] = (uint8_t)(seed >> 24);
+    }
+
+    // What the copy has to read back as
+    uint64_t expect = 0;
+    for(uint64_t done = 0; done < bytes; done += chunk)
+        expect = checksum(expect, pattern, (bytes - done < chunk) ? bytes - done : chunk);
+
+    fprintf(info, "io bench: %s, %.1f MB of data in %zu byte blocks, best of %d\n", wavfile, bytes / 1e6, chunk, BENCH_IO_REPEAT);
+    fprintf(info, "cold page cache for both, writes include the fsync\n\n");
+    fprintf(info, "read               MB/s  | write              MB/s\n");
+
+    uint64_t sums[2] = { 0, 0 };
+    uint64_t got = 0;
+    for(int b = 0; b < 2; b++)
+    {
+        const char* readName = "-";
+        const char* writeName = "-";
+        double readBest = 1e30, writeBest = 1e30;
+
+        for(int r = 0; r < BENCH_IO_REPEAT; r++)
+        {
+            dropCache(wavfile);
+            double t = readPass(wavfile, backends[b], buf, chunk, &sums[b], &got, &readName);
+            readBest = (t >= 0.0 && t < readBest) ? t : readBest;
+
+            t = writePass(outfile, backends[b], pattern, chunk, bytes, sample_rate, bits_per_sample, channels, &writeName);
+            writeBest = (t >= 0.0 && t < writeBest) ? t : writeBest;
+        }
+
+        if(readBest == 1e30 || writeBest == 1e30)
+        {
+            fprintf(stderr, "Unable to read %s or write %s\n", wavfile, outfile);
+            ok = false;
+            break;
+        }
+
+        // The copy read back through stdio
+        uint64_t copy = 0, copyBytes = 0;
+        const char* name;
+        dropCache(outfile);
+        if(readPass(outfile, WAV_IO_STDIO, buf, chunk, &copy, &copyBytes, &name) < 0.0 || copy != expect || copyBytes != bytes)
+        {
+            fprintf(stderr, "%s wrote different data than it was given\n", writeName);
+            ok = false;
+        }
+
+        fprintf(info, "%-17s %6.0f  | %-17s %6.0f\n", readName, got / 1e6 / readBest, writeName, bytes / 1e6 / writeBest);
+    }
+
+    if(sums[0] != sums[1])
+    {
+        fprintf(stderr, "the backends read different data from %s\n", wavfile);
+        ok = false;
+    }
+
+    remove(outfile);
+    free(buf);
+    free(pattern);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Damped 8 lane comb bank, see comb8.h
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "comb8.h"
+#include "rt.h"
+#include "simd.h"
+#include "telemetry.h"
+
+#define COMB8_VECS (REVERB_COMB8_LANES / SIMD_LANES)
+
+// Freeverb tuning at 48 kHz
+static const int iCOMB8_DEFAULT_SIZE[REVERB_COMB8_LANES] = { 1215, 1293, 1390, 1476, 1548, 1623, 1695, 1760 };
+static const float fCOMB8_FEEDBACK = 0.84f;
+static const float fCOMB8_DAMP = 0.2f;
+static const float fCOMB8_INPUT_GAIN = 0.65f; // about the wet level of the Schroeder network
+
+static int delayLength(int lane, float modReverb, int decimation)
+{
+    return (int)(expf(2.9 * modReverb) * iCOMB8_DEFAULT_SIZE[lane]) / decimation;
+}
+
+// Power of two above the longest delay
+static int lineRows(int decimation)
+{
+    int rows = 1;
+
+    while(rows <= delayLength(REVERB_COMB8_LANES - 1, 1.f, decimation))
+        rows <<= 1;
+
+    return rows;
+}
+
+size_t comb8_memory_size(int decimation)
+{
+    return rt_arena_bytes((size_t)lineRows(decimation) * REVERB_COMB8_LANES * sizeof(float));
+}
+
+bool comb8_setup(reverb_t* rv)
+{
+    const int rows = lineRows(rv->decimation);
+
+    rv->fComb8 = (float*)rt_calloc(rv->arena, (size_t)rows * REVERB_COMB8_LANES, sizeof(float));
+    if(!rv->fComb8)
+        return false;
+
+    rv->iComb8Mask = rows - 1;
+    comb8_set_mod(rv);
+    comb8_reset(rv);
+
+    return true;
+}
+
+void comb8_cleanup(reverb_t* rv)
+{
+    rt_free(rv->arena, rv->fComb8);
+    rv->fComb8 = NULL;
+}
+
+void comb8_set_mod(reverb_t* rv)
+{
+    for(int l = 0; l < REVERB_COMB8_LANES; l++)
+        rv->iComb8Delay[l] = delayLength(l, rv->modReverb, rv->decimation);
+}
+
+void comb8_reset(reverb_t* rv)
+{
+    memset(rv->fComb8, 0, (size_t)(rv->iComb8Mask + 1) * REVERB_COMB8_LANES * sizeof(float));
+    memset(rv->fComb8Filter, 0, sizeof(rv->fComb8Filter));
+    rv->iComb8Write = 0;
+}
+
+void comb8_process(reverb_t* rv, const float* in, float* out, int n)
+{
+    const int rows = rv->iComb8Mask + 1;
+    float* line = rv->fComb8;
+    int write = rv->iComb8Write;
+    vf_t filter[COMB8_VECS];
+    int read[REVERB_COMB8_LANES];
+
+    const vf_t vDamp = vf_set1(fCOMB8_DAMP);
+    const vf_t vUndamp = vf_set1(1.f - fCOMB8_DAMP);
+    const vf_t vFeedback = vf_set1(fCOMB8_FEEDBACK);
+
+    for(int v = 0; v < COMB8_VECS; v++)
+        filter[v] = vf_loadu(&rv->fComb8Filter[v * SIMD_LANES]);
+
+    for(int l = 0; l < REVERB_COMB8_LANES; l++)
+        read[l] = (write - rv->iComb8Delay[l]) & rv->iComb8Mask;
+
+    while(n > 0)
+    {
+        // Up to the next wrap of the write row or any read row
+        int run = rows - write;
+        for(int l = 0; l < REVERB_COMB8_LANES; l++)
+            run = (rows - read[l] < run) ? rows - read[l] : run;
+        run = (n < run) ? n : run;
+
+        float* row = &line[write * REVERB_COMB8_LANES];
+        const float* tap[REVERB_COMB8_LANES];
+        for(int l = 0; l < REVERB_COMB8_LANES; l++)
+            tap[l] = &line[read[l] * REVERB_COMB8_LANES + l];
+
+        for(int s = 0; s < run; s++)
+        {
+            const vf_t x = vf_set1(in[s] * fCOMB8_INPUT_GAIN);
+            const int offset = s * REVERB_COMB8_LANES;
+            float delayed[REVERB_COMB8_LANES];
+
+            for(int v = 0; v < COMB8_VECS; v++)
+            {
+                // Every lane reads at its own delay, gathered through memory
+                float gather[SIMD_LANES];
+                for(int l = 0; l < SIMD_LANES; l++)
+                    gather[l] = tap[v * SIMD_LANES + l][offset];
+                const vf_t d = vf_loadu(gather);
+
+                filter[v] = vf_madd(filter[v], vDamp, d * vUndamp);
+                vf_storeu(&row[offset + v * SIMD_LANES], vf_madd(vFeedback, filter[v], x));
+                vf_storeu(&delayed[v * SIMD_LANES], d);
+            }
+
+            // Fixed summation order, the same for any vector width
+            const float a = (delayed[0] + delayed[4]) + (delayed[2] + delayed[6]);
+            const float b = (delayed[1] + delayed[5]) + (delayed[3] + delayed[7]);
+            out[s] = hardClip(a + b);
+        }
+
+        write = (write + run) & rv->iComb8Mask;
+        for(int l = 0; l < REVERB_COMB8_LANES; l++)
+            read[l] = (read[l] + run) & rv->iComb8Mask;
+
+        in += run;
+        out += run;
+        n -= run;
+    }
+
+    for(int v = 0; v < COMB8_VECS; v++)
+        vf_storeu(&rv->fComb8Filter[v * SIMD_LANES], filter[v]);
+    rv->iComb8Write = write;
+}
+
+void comb8_peak_energy(const reverb_t* rv, float* peak, double* energy)
+{
+    const int rows = rv->iComb8Mask + 1;
+    int reach = 0;
+    for(int l = 0; l < REVERB_COMB8_LANES; l++)
+        reach = (rv->iComb8Delay[l] > reach) ? rv->iComb8Delay[l] : reach;
+
+    // The rows before the write row, wrapping at most once
+    const int start = (rv->iComb8Write - reach) & rv->iComb8Mask;
+    const int first = (rows - start < reach) ? rows - start : reach;
+    float p[3];
+    double e[3];
+
+    telemetry_peak_energy(&rv->fComb8[start * REVERB_COMB8_LANES], first * REVERB_COMB8_LANES, &p[0], &e[0]);
+    telemetry_peak_energy(rv->fComb8, (reach - first) * REVERB_COMB8_LANES, &p[1], &e[1]);
+    telemetry_peak_energy(rv->fComb8Filter, REVERB_COMB8_LANES, &p[2], &e[2]);
+
+    *peak = fmaxf(fmaxf(p[0], p[1]), p[2]);
+    *energy = e[0] + e[1] + e[2];
+}
@@ -0,0 +1,573 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Conformance and performance regression check, see conform.h
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "conform.h"
+#include "plan.h"
+#include "reverb.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#define CONFORM_SAMPLE_RATE 48000
+#define CONFORM_SECONDS     2
+#define CONFORM_BLOCK       1000 // not a power of 2, crosses the internal chunks
+#define CONFORM_MOD         0.3f
+#define CONFORM_ROUNDS      5    // fresh engines per variant, the memory layout moves the timing
+#define CONFORM_REPEAT      3    // timed renders per round, round robin over the variants
+#define CONFORM_BASELINE    2    // baseline format, since 2 relative to the calibration loop
+#define CONFORM_MAX_LINES   1024
+#define CONFORM_LINE        256
+#define CONFORM_PATH        1100
+#define CONFORM_MAX_DIR     (CONFORM_PATH - 128) // room for the file names
+
+enum
+{
+    SIGNAL_IMPULSE,
+    SIGNAL_NOISE,
+    SIGNAL_SWEEP,
+    SIGNAL_ONSET, // silence, then noise
+    SIGNAL_LOUD,  // full scale noise, exercises the clipping
+    NUM_SIGNALS
+};
+
+static const char* const signalNames[NUM_SIGNALS] = { "impulse", "noise", "sweep", "onset", "loud" };
+
+typedef struct variant
+{
+    int engine;
+    int kernel;
+    bool exact; // bit exact against the first variant of the engine
+} variant_t;
+
+// The first variant of each engine is its reference
+static const variant_t variants[] = {
+    { REVERB_ENGINE_SCHROEDER, REVERB_KERNEL_FUSED,    true  },
+    { REVERB_ENGINE_SCHROEDER, REVERB_KERNEL_STAGED,   true  },
+    { REVERB_ENGINE_SCHROEDER, REVERB_KERNEL_THREADED, true  },
+    { REVERB_ENGINE_SCHROEDER, REVERB_KERNEL_SIMD,     true  },
+    { REVERB_ENGINE_SCHROEDER, REVERB_KERNEL_SCAN,     false },
+    { REVERB_ENGINE_COMB8,     REVERB_KERNEL_FUSED,    true  },
+    { REVERB_ENGINE_VELVET,    REVERB_KERNEL_FUSED,    true  },
+};
+
+#define NUM_VARIANTS (int)(sizeof(variants) / sizeof(variants[0]))
+
+static const int decimations[] = { 1, 2, 4 };
+
+typedef struct baseline
+{
+    char lines[CONFORM_MAX_LINES][CONFORM_LINE]; // other hosts, kept as is
+    int numLines;
+    char names[CONFORM_MAX_LINES][64];           // this host
+    double cost[CONFORM_MAX_LINES];              // relative to the calibration loop
+    int num;
+} baseline_t;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void noise(float* x, int n, float amplitude)
+{
+    uint32_t seed = 4711;
+    for(int s = 0; s < n; s++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        x[s] = ((int32_t)(seed >> 8) - (1 << 23)) * (amplitude / (1 << 23));
+    }
+}
+
+static void makeSignal(int signal, float* x, int n)
+{
+    memset(x, 0, n * sizeof(float));
+
+    switch(signal)
+    {
+    case SIGNAL_IMPULSE:
+        x[0] = 16384.f;
+        break;
+    case SIGNAL_NOISE:
+        noise(x, n, 8000.f);
+        break;
+    case SIGNAL_SWEEP:
+    {
+        // Exponential 20 Hz ... 20 kHz, phase in double to stay reproducible
+        const double k = log(20000.0 / 20.0);
+        const double T = (double)n / CONFORM_SAMPLE_RATE;
+        for(int s = 0; s < n; s++)
+        {
+            const double t = (double)s / CONFORM_SAMPLE_RATE;
+            x[s] = (float)(12000.0 * sin(2.0 * M_PI * 20.0 * T / k * (exp(t / T * k) - 1.0)));
+        }
+        break;
+    }
+    case SIGNAL_ONSET:
+        noise(&x[n/4], n - n/4, 8000.f);
+        break;
+    case SIGNAL_LOUD:
+        noise(x, n, MAX_SMP_VAL);
+        break;
+    }
+}
+
+static void variantName(const variant_t* v, int decimation, char* name, size_t size)
+{
+    if(v->engine == REVERB_ENGINE_SCHROEDER)
+        snprintf(name, size, "%s-%s-d%d", reverb_engine_name(v->engine), reverb_kernel_name(v->kernel), decimation);
+    else
+        snprintf(name, size, "%s-d%d", reverb_engine_name(v->engine), decimation);
+}
+
+static bool setupVariant(reverb_t* rv, const variant_t* v, int decimation)
+{
+    if(!reverb_setup_decimated(rv, decimation) || !reverb_set_engine(rv, v->engine) ||
+       !reverb_set_kernel(rv, v->kernel))
+    {
+        reverb_cleanup(rv);
+        return false;
+    }
+    reverb_set_mod(rv, CONFORM_MOD);
+    reverb_reset(rv);
+
+    return true;
+}
+
+static void render(reverb_t* rv, const float* in, float* out, int n)
+{
+    for(int s = 0; s < n; s += CONFORM_BLOCK)
+        reverb_process_block(rv, &in[s], &out[s], (n - s < CONFORM_BLOCK) ? n - s : CONFORM_BLOCK);
+}
+
+static bool readReference(const char* path, float* x, int n)
+{
+    FILE* f = fopen(path, "rb");
+    if(!f)
+        return false;
+
+    uint8_t b[4];
+    int s = 0;
+    for(; s < n && fread(b, 1, 4, f) == 4; s++)
+    {
+        uint32_t bits = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+        memcpy(&x[s], &bits, sizeof(bits));
+    }
+    const bool ok = (s == n) && fgetc(f) == EOF;
+    fclose(f);
+
+    return ok;
+}
+
+static bool writeReference(const char* path, const float* x, int n)
+{
+    FILE* f = fopen(path, "wb");
+    if(!f)
+        return false;
+
+    for(int s = 0; s < n; s++)
+    {
+        uint32_t bits;
+        memcpy(&bits, &x[s], sizeof(bits));
+        const uint8_t b[4] = { (uint8_t)bits, (uint8_t)(bits >> 8), (uint8_t)(bits >> 16), (uint8_t)(bits >> 24) };
+        fwrite(b, 1, 4, f);
+    }
+
+    return fclose(f) == 0;
+}
+
+static float maxDiff(const float* a, const float* b, int n)
+{
+    float d = 0.f;
+    for(int s = 0; s < n; s++)
+        d = fmaxf(d, fabsf(a[s] - b[s]));
+    return d;
+}
+
+static void loadBaseline(const char* path, const char* host, baseline_t* bl)
+{
+    char line[CONFORM_LINE];
+
+    bl->numLines = bl->num = 0;
+
+    FILE* f = fopen(path, "r");
+    if(!f)
+        return;
+
+    // Older baselines hold absolute ns/sample, they are recorded again
+    int version = 0;
+    if(!fgets(line, sizeof(line), f) || sscanf(line, "conform-baseline %d", &version) != 1 ||
+       version != CONFORM_BASELINE)
+    {
+        fclose(f);
+        return;
+    }
+
+    while(fgets(line, sizeof(line), f) && bl->numLines < CONFORM_MAX_LINES && bl->num < CONFORM_MAX_LINES)
+    {
+        char h[128], name[64];
+        double cost;
+
+        if(sscanf(line, "%127s %63s %lf", h, name, &cost) != 3)
+            continue;
+
+        if(strcmp(h, host))
+        {
+            strcpy(bl->lines[bl->numLines++], line);
+            continue;
+        }
+        strcpy(bl->names[bl->num], name);
+        bl->cost[bl->num++] = cost;
+    }
+    fclose(f);
+}
+
+static double findBaseline(const baseline_t* bl, const char* name)
+{
+    for(int k = 0; k < bl->num; k++)
+    {
+        if(!strcmp(bl->names[k], name))
+            return bl->cost[k];
+    }
+    return 0.0;
+}
+
+static bool storeBaseline(const char* path, const char* host, const baseline_t* bl)
+{
+    char tmp[CONFORM_PATH];
+
+#if defined(__unix__) || defined(__APPLE__)
+    const int len = snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+#else
+    const int len = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+#endif
+    if(len < 0 || len >= (int)sizeof(tmp))
+        return false; // a cut name would be some other file
+
+    FILE* f = fopen(tmp, "w");
+    if(!f)
+        return false;
+
+    fprintf(f, "conform-baseline %d\n", CONFORM_BASELINE);
+    for(int k = 0; k < bl->numLines; k++)
+        fputs(bl->lines[k], f);
+    for(int k = 0; k < bl->num; k++)
+        fprintf(f, "%s %s %.4f\n", host, bl->names[k], bl->cost[k]);
+
+    if(fclose(f) != 0)
+    {
+        remove(tmp);
+        return false;
+    }
+
+#ifdef _WIN32
+    remove(path); // rename does not replace on Windows
+#endif
+    if(rename(tmp, path) != 0)
+    {
+        remove(tmp);
+        return false;
+    }
+
+    return true;
+}
+
+// Outputs of all variants against each other and the references
+static int checkOutputs(const char* dir, bool record, float* in, float* const* out, int n, FILE* info)
+{
+    char path[CONFORM_PATH], name[64];
+    float* ref = (float*)malloc(n * sizeof(float));
+    int failures = 0;
+
+    if(!ref)
+        return 1;
+
+    fprintf(info, "%-8s  %-24s  %s\n", "signal", "variant", "result");
+
+    for(int sig = 0; sig < NUM_SIGNALS; sig++)
+    {
+        makeSignal(sig, in, n);
+
+        for(int d = 0; d < 3; d++)
+        {
+            int first = -1;
+
+            for(int v = 0; v < NUM_VARIANTS; v++)
+            {
+                reverb_t rv;
+
+                variantName(&variants[v], decimations[d], name, sizeof(name));
+                if(!setupVariant(&rv, &variants[v], decimations[d]))
+                {
+                    fprintf(info, "%-8s  %-24s  not available\n", signalNames[sig], name);
+                    continue;
+                }
+                render(&rv, in, out[v], n);
+                reverb_cleanup(&rv);
+
+                // Kernels of one engine promise identical output, or close
+                // to it for the ones that round differently
+                if(first < 0 || variants[first].engine != variants[v].engine)
+                    first = v;
+                const float kernelDiff = maxDiff(out[first], out[v], n);
+                if(first != v && (variants[v].exact ? memcmp(out[first], out[v], n * sizeof(float)) != 0
+                                                    : !(kernelDiff <= CONFORM_TOLERANCE)))
+                {
+                    fprintf(info, "%-8s  %-24s  FAIL differs from %s by %g\n", signalNames[sig], name,
+                            reverb_kernel_name(variants[first].kernel), kernelDiff);
+                    failures++;
+                    continue;
+                }
+
+                snprintf(path, sizeof(path), "%s/%s-%s-d%d.f32", dir, signalNames[sig],
+                         reverb_engine_name(variants[v].engine), decimations[d]);
+
+                if(record)
+                {
+                    if(first == v && !writeReference(path, out[v], n))
+                    {
+                        fprintf(stderr, "Unable to write reference %s\n", path);
+                        failures++;
+                    }
+                    continue;
+                }
+
+                if(!readReference(path, ref, n))
+                {
+                    fprintf(info, "%-8s  %-24s  FAIL no reference %s\n", signalNames[sig], name, path);
+                    failures++;
+                    continue;
+                }
+
+                const float diff = maxDiff(ref, out[v], n);
+                if(diff > CONFORM_TOLERANCE || diff != diff)
+                {
+                    fprintf(info, "%-8s  %-24s  FAIL max diff %g\n", signalNames[sig], name, diff);
+                    failures++;
+                }
+                else if(memcmp(ref, out[v], n * sizeof(float)))
+                {
+                    fprintf(info, "%-8s  %-24s  max diff %g\n", signalNames[sig], name, diff);
+                }
+                else
+                {
+                    fprintf(info, "%-8s  %-24s  exact\n", signalNames[sig], name);
+                }
+            }
+        }
+    }
+
+    free(ref);
+
+    return failures;
+}
+
+static double timeRender(reverb_t* rv, const float* in, float* out, int n)
+{
+    double t0 = now();
+    render(rv, in, out, n);
+    return (now() - t0) * 1e9 / n;
+}
+
+// Fixed work the variants are measured against: four scalar feedback combs
+// over lines as long as the engine's, so it sees the clock, the load and the
+// cache pressure on the machine like the engine does, but no change to it
+#define CONFORM_CAL_LINES 4
+
+static double timeCalibration(float* lines, int length, const float* in, float* out, int n)
+{
+    static const int delays[CONFORM_CAL_LINES] = { 1009, 1361, 1657, 1999 };
+    int pos = 0;
+
+    double t0 = now();
+    for(int s = 0; s < n; s++)
+    {
+        float y = 0.f;
+        for(int k = 0; k < CONFORM_CAL_LINES; k++)
+        {
+            float* line = &lines[k * length];
+            int read = pos - delays[k] * (length / delays[CONFORM_CAL_LINES - 1]);
+            if(read < 0)
+                read += length;
+            const float x = in[s] + 0.7f * line[read];
+            line[pos] = x;
+            y += x;
+        }
+        out[s] = y;
+        if(++pos == length)
+            pos = 0;
+    }
+    return (now() - t0) * 1e9 / n;
+}
+
+// Cost of every variant on noise relative to the calibration loop, against
+// the baseline of this host. Timing is reported, not counted as a failure.
+static int checkPerformance(const char* dir, bool record, float* in, float* out, int n, FILE* info)
+{
+    static baseline_t bl;
+    static reverb_t rv[NUM_VARIANTS];
+    char path[CONFORM_PATH], host[128], name[64];
+    int failures = 0, slow = 0;
+
+    plan_host_name(host, sizeof(host));
+    snprintf(path, sizeof(path), "%s/baseline.txt", dir);
+    loadBaseline(path, host, &bl);
+
+    makeSignal(SIGNAL_NOISE, in, n);
+
+    fprintf(info, "\nperformance on %s, best of %d, relative to the calibration loop\n", host,
+            CONFORM_ROUNDS * CONFORM_REPEAT);
+    fprintf(info, "%-24s  %9s  %9s  %9s  %s\n", "variant", "ns/sample", "relative", "baseline", "change");
+
+    for(int d = 0; d < 3; d++)
+    {
+        const int length = iMAX_BUFFER_SIZE / decimations[d];
+        bool ok[NUM_VARIANTS];
+        double ns[NUM_VARIANTS];
+        double cal = 1e30;
+
+        for(int v = 0; v < NUM_VARIANTS; v++)
+            ns[v] = 1e30;
+
+        for(int round = 0; round < CONFORM_ROUNDS; round++)
+        {
+            // New lines every round, where they land in memory changes the
+            // speed by up to 2x from one allocation to the next. Each is
+            // warmed up before anything counts.
+            float* lines = (float*)calloc((size_t)CONFORM_CAL_LINES * length, sizeof(float));
+            if(!lines)
+            {
+                fprintf(stderr, "Unable to allocate memory for buffer\n");
+                return failures + 1;
+            }
+            timeCalibration(lines, length, in, out, n);
+            for(int v = 0; v < NUM_VARIANTS; v++)
+            {
+                ok[v] = setupVariant(&rv[v], &variants[v], decimations[d]);
+                if(ok[v])
+                    render(&rv[v], in, out, n);
+            }
+
+            // Round robin, so a burst of other load hits one repeat of
+            // every variant instead of all repeats of one
+            for(int r = 0; r < CONFORM_REPEAT; r++)
+            {
+                cal = fmin(cal, timeCalibration(lines, length, in, out, n));
+                for(int v = 0; v < NUM_VARIANTS; v++)
+                {
+                    if(ok[v])
+                        ns[v] = fmin(ns[v], timeRender(&rv[v], in, out, n));
+                }
+            }
+
+            for(int v = 0; v < NUM_VARIANTS; v++)
+            {
+                if(ok[v])
+                    reverb_cleanup(&rv[v]);
+            }
+            free(lines);
+        }
+
+        snprintf(name, sizeof(name), "calibration-d%d", decimations[d]);
+        fprintf(info, "%-24s  %9.2f\n", name, cal);
+
+        for(int v = 0; v < NUM_VARIANTS; v++)
+        {
+            if(!ok[v])
+                continue;
+
+            variantName(&variants[v], decimations[d], name, sizeof(name));
+            const double rel = ns[v] / cal;
+            const double base = findBaseline(&bl, name);
+
+            if(record || base <= 0.0)
+            {
+                fprintf(info, "%-24s  %9.2f  %9.3f  %9s  %s\n", name, ns[v], rel, "-", record ? "recorded" : "no baseline");
+            }
+            else
+            {
+                const bool over = rel > base * CONFORM_MAX_SLOWDOWN;
+                fprintf(info, "%-24s  %9.2f  %9.3f  %9.3f  %+6.1f%%%s\n", name, ns[v], rel, base, (rel / base - 1.0) * 100.0,
+                        over ? "  SLOW" : "");
+                slow += over;
+            }
+
+            if(record)
+            {
+                int k = 0;
+                while(k < bl.num && strcmp(bl.names[k], name))
+                    k++;
+                if(k == CONFORM_MAX_LINES)
+                    continue;
+                strcpy(bl.names[k], name);
+                bl.cost[k] = rel;
+                bl.num += (k == bl.num);
+            }
+        }
+    }
+
+    if(slow)
+        fprintf(info, "%d variants more than %.0f%% slower than the baseline, not counted as failures\n", slow,
+                (CONFORM_MAX_SLOWDOWN - 1.0) * 100.0);
+
+    if(record && !storeBaseline(path, host, &bl))
+    {
+        fprintf(stderr, "Unable to write baseline %s\n", path);
+        failures++;
+    }
+
+    return failures;
+}
+
+int conform_run(const char* dir, bool record, FILE* info)
+{
+    const int n = CONFORM_SECONDS * CONFORM_SAMPLE_RATE;
+    float* in = (float*)malloc(n * sizeof(float));
+    float* out[NUM_VARIANTS];
+    bool ok = (in != NULL);
+
+    for(int v = 0; v < NUM_VARIANTS; v++)
+    {
+        out[v] = (float*)malloc(n * sizeof(float));
+        ok = ok && out[v];
+    }
+
+    int failures = 0;
+    if(!ok)
+    {
+        fprintf(stderr, "Unable to allocate memory for buffer\n");
+        failures = 1;
+    }
+    else if(strlen(dir) > CONFORM_MAX_DIR)
+    {
+        fprintf(stderr, "Conform directory name longer than %d characters\n", CONFORM_MAX_DIR);
+        failures = 1;
+    }
+    else
+    {
+        fprintf(info, "conform: %d signals of %d s, modReverb = %.2f, %s %s\n\n", NUM_SIGNALS, CONFORM_SECONDS,
+                CONFORM_MOD, record ? "recording references to" : "references in", dir);
+        failures += checkOutputs(dir, record, in, out, n, info);
+        failures += checkPerformance(dir, record, in, out[0], n, info);
+        fprintf(info, "\nconform: %s, %d failures\n", failures ? "FAILED" : "passed", failures);
+    }
+
+    for(int v = 0; v < NUM_VARIANTS; v++)
+        free(out[v]);
+    free(in);
+
+    return failures ? 1 : 0;
+}
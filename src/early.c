@@ -0,0 +1,214 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Early reflections tapped delay line, see early.h. The input block is
+  written to the line first, then every tap adds one contiguous run of
+  the line to the outputs. Going tap by tap keeps the inner loop a plain
+  vector multiply-add, a run only breaks where the line wraps.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "early.h"
+#include "reverb.h"
+#include "rt.h"
+#include "simd.h"
+#include "telemetry.h"
+
+bool early_load(early_t* er, const char* path, int sample_rate)
+{
+    char line[256];
+    int num = 0;
+    int maxDelay = 0;
+
+    memset(er, 0, sizeof(*er));
+
+    FILE* f = fopen(path, "r");
+    if(!f)
+    {
+        fprintf(stderr, "Unable to open tap table %s\n", path);
+        return false;
+    }
+
+    while(fgets(line, sizeof(line), f))
+    {
+        float ms, gain, pan;
+        char* p = strchr(line, '#');
+        if(p)
+            *p = '\0';
+
+        int fields = sscanf(line, "%f %f %f", &ms, &gain, &pan);
+        if(fields <= 0)
+            continue;
+        if(fields == 2)
+            pan = 0.f;
+
+        if(fields == 1 || ms < 0.f || ms > EARLY_MAX_DELAY || pan < -1.f || pan > 1.f)
+        {
+            fprintf(stderr, "Bad tap in %s: %s\n", path, line);
+            fclose(f);
+            return false;
+        }
+        if(num == EARLY_MAX_TAPS)
+        {
+            fprintf(stderr, "More than %d taps in %s\n", EARLY_MAX_TAPS, path);
+            fclose(f);
+            return false;
+        }
+
+        // Constant power pan
+        const float angle = (pan + 1.f) * (float)M_PI / 4.f;
+        er->delay[num] = (int)(ms * sample_rate / 1000.f + 0.5f);
+        er->gain[num] = gain;
+        er->gainL[num] = gain * cosf(angle);
+        er->gainR[num] = gain * sinf(angle);
+        if(er->delay[num] > maxDelay)
+            maxDelay = er->delay[num];
+        num++;
+    }
+    fclose(f);
+
+    if(!num)
+    {
+        fprintf(stderr, "No taps in %s\n", path);
+        return false;
+    }
+    er->numTaps = num;
+
+    // A block is written before it is read, so the line holds both
+    int size = 1;
+    while(size < maxDelay + EARLY_BLOCK)
+        size <<= 1;
+
+    er->line = (float*)calloc(size, sizeof(float));
+    er->mask = size - 1;
+
+    return er->line != NULL;
+}
+
+void early_cleanup(early_t* er)
+{
+    rt_free(er->arena, er->line);
+    er->line = NULL;
+}
+
+size_t early_memory_size(const early_t* er)
+{
+    return rt_arena_bytes((size_t)(er->mask + 1) * sizeof(float));
+}
+
+bool early_move_to_arena(early_t* er, rt_arena_t* arena)
+{
+    // Nothing written yet, the arena block is zeroed like the line
+    float* line = (float*)rt_arena_alloc(arena, (size_t)(er->mask + 1) * sizeof(float));
+    if(!line)
+        return false;
+
+    rt_free(er->arena, er->line);
+    er->line = line;
+    er->arena = arena;
+
+    return true;
+}
+
+static void processTaps(early_t* er, const float* in, float* mono, float* left, float* right, int n)
+{
+    // Write the block, at most one wrap
+    const int first = (er->mask + 1 - er->write < n) ? er->mask + 1 - er->write : n;
+    memcpy(&er->line[er->write], in, first * sizeof(float));
+    memcpy(er->line, &in[first], (n - first) * sizeof(float));
+
+    memset(mono, 0, n * sizeof(float));
+    memset(left, 0, n * sizeof(float));
+    memset(right, 0, n * sizeof(float));
+
+    for(int t = 0; t < er->numTaps; t++)
+    {
+        const vf_t g = vf_set1(er->gain[t]);
+        const vf_t gL = vf_set1(er->gainL[t]);
+        const vf_t gR = vf_set1(er->gainR[t]);
+        int read = (er->write - er->delay[t]) & er->mask;
+        int s = 0;
+
+        while(s < n)
+        {
+            const int run = (er->mask + 1 - read < n - s) ? er->mask + 1 - read : n - s;
+            const float* x = &er->line[read];
+            int k = 0;
+
+            for(; k + SIMD_LANES <= run; k += SIMD_LANES)
+            {
+                const vf_t v = vf_loadu(&x[k]);
+                vf_storeu(&mono[s+k], vf_madd(g, v, vf_loadu(&mono[s+k])));
+                vf_storeu(&left[s+k], vf_madd(gL, v, vf_loadu(&left[s+k])));
+                vf_storeu(&right[s+k], vf_madd(gR, v, vf_loadu(&right[s+k])));
+            }
+            for(; k < run; k++)
+            {
+                mono[s+k] += er->gain[t] * x[k];
+                left[s+k] += er->gainL[t] * x[k];
+                right[s+k] += er->gainR[t] * x[k];
+            }
+
+            read = (read + run) & er->mask;
+            s += run;
+        }
+    }
+
+    er->write = (er->write + n) & er->mask;
+}
+
+void early_process(early_t* er, const float* in, float* mono, float* left, float* right, int n)
+{
+    for(int s = 0; s < n; s += EARLY_BLOCK)
+    {
+        const int len = (n - s < EARLY_BLOCK) ? n - s : EARLY_BLOCK;
+        processTaps(er, &in[s], &mono[s], &left[s], &right[s], len);
+    }
+
+    for(int s = 0; s < n; s++)
+        mono[s] = hardClip(mono[s]);
+}
+
+void early_add_wet(const float* wet, float* left, float* right, int n)
+{
+    const vf_t lo = vf_set1(MIN_SMP_VAL);
+    const vf_t hi = vf_set1(MAX_SMP_VAL);
+    int s = 0;
+
+    for(; s + SIMD_LANES <= n; s += SIMD_LANES)
+    {
+        const vf_t w = vf_loadu(&wet[s]);
+        vf_storeu(&left[s], vf_clamp(vf_loadu(&left[s]) + w, lo, hi));
+        vf_storeu(&right[s], vf_clamp(vf_loadu(&right[s]) + w, lo, hi));
+    }
+    for(; s < n; s++)
+    {
+        left[s] = hardClip(left[s] + wet[s]);
+        right[s] = hardClip(right[s] + wet[s]);
+    }
+}
+
+void early_peak_energy(const early_t* er, float* peak, double* energy)
+{
+    const int size = er->mask + 1;
+    int reach = 0;
+    for(int t = 0; t < er->numTaps; t++)
+        reach = (er->delay[t] > reach) ? er->delay[t] : reach;
+
+    const int start = (er->write - reach) & er->mask;
+    const int first = (size - start < reach) ? size - start : reach;
+    float p[2];
+    double e[2];
+
+    telemetry_peak_energy(&er->line[start], first, &p[0], &e[0]);
+    telemetry_peak_energy(er->line, reach - first, &p[1], &e[1]);
+
+    *peak = fmaxf(p[0], p[1]);
+    *energy = e[0] + e[1];
+}
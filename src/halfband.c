@@ -0,0 +1,107 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Polyphase half-band FIR decimator and interpolator by 2.
+  Kaiser windowed sinc (beta = 6), odd taps normalized to unity DC gain.
+*/
+
+#include <string.h>
+
+#include "halfband.h"
+
+#define HALFBAND_CENTER (2*HALFBAND_PAIRS-1)
+
+// Coefficients at +-1, +-3, +-5, ... taps from the center
+static const float fHB_COEFF[HALFBAND_PAIRS] = {
+    3.159119960e-01f,
+    -9.906878206e-02f,
+    5.251087362e-02f,
+    -3.098618462e-02f,
+    1.848745561e-02f,
+    -1.064907027e-02f,
+    5.707912433e-03f,
+    -2.717897827e-03f,
+    1.052878639e-03f,
+    -2.491814906e-04f
+};
+
+void halfband_dec_init(halfband_dec_t* hb)
+{
+    memset(hb, 0, sizeof(*hb));
+}
+
+void halfband_int_init(halfband_int_t* hb)
+{
+    memset(hb, 0, sizeof(*hb));
+}
+
+int halfband_decimate(halfband_dec_t* hb, const float* x, int n, float* y)
+{
+    // b[i + t], t = 0...HALFBAND_LEN-1, is the filter window ending at x[i]
+    float b[HALFBAND_LEN - 1 + HALFBAND_MAX_BLOCK];
+    // Every other sample, the phase the non-zero side taps fall on
+    float q[(HALFBAND_LEN + HALFBAND_MAX_BLOCK)/2 + 1];
+
+    memcpy(b, hb->hist, sizeof(hb->hist));
+    memcpy(b + HALFBAND_LEN - 1, x, n * sizeof(float));
+
+    // The first output completes with x[0] if one input is pending
+    const int i0 = hb->phase ? 0 : 1;
+    const int num = (n > i0) ? (n - i0 + 1) / 2 : 0;
+
+    for(int j = 0; j < num + 2*HALFBAND_PAIRS - 1; j++)
+        q[j] = b[i0 + 2*j];
+
+    for(int m = 0; m < num; m++)
+        y[m] = 0.5f * b[i0 + 2*m + HALFBAND_CENTER];
+
+    for(int k = 0; k < HALFBAND_PAIRS; k++)
+    {
+        const float c = fHB_COEFF[k];
+        const float* lo = &q[HALFBAND_PAIRS - 1 - k];
+        const float* hi = &q[HALFBAND_PAIRS + k];
+        for(int m = 0; m < num; m++)
+            y[m] += c * (lo[m] + hi[m]);
+    }
+
+    memcpy(hb->hist, b + n, sizeof(hb->hist));
+    hb->phase = (hb->phase + n) & 1;
+
+    return num;
+}
+
+void halfband_interpolate(halfband_int_t* hb, const float* y, int n, float* z)
+{
+    const int H = 2*HALFBAND_PAIRS - 1;
+    // b[m + t], t = 0...2*HALFBAND_PAIRS-1, are the inputs seen by y[m]
+    float b[2*HALFBAND_PAIRS - 1 + HALFBAND_MAX_BLOCK];
+    float even[HALFBAND_MAX_BLOCK];
+
+    memcpy(b, hb->hist, sizeof(hb->hist));
+    memcpy(b + H, y, n * sizeof(float));
+
+    for(int m = 0; m < n; m++)
+        even[m] = 0.f;
+
+    for(int k = 0; k < HALFBAND_PAIRS; k++)
+    {
+        const float c = fHB_COEFF[k];
+        const float* lo = &b[HALFBAND_PAIRS - 1 - k];
+        const float* hi = &b[HALFBAND_PAIRS + k];
+        for(int m = 0; m < n; m++)
+            even[m] += c * (lo[m] + hi[m]);
+    }
+
+    // Zero stuffing halves the gain, the even phase makes up for it,
+    // the odd phase is the center tap only
+    for(int m = 0; m < n; m++)
+    {
+        z[2*m] = 2.f * even[m];
+        z[2*m + 1] = b[m + HALFBAND_PAIRS];
+    }
+
+    memcpy(hb->hist, b + n, sizeof(hb->hist));
+}
@@ -0,0 +1,333 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Kernel planner and wisdom file, see plan.h
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "plan.h"
+#include "reverb.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#define PLAN_DEFAULT_BLOCK 4096
+#define PLAN_SAMPLE_RATE   48000
+#define PLAN_MAX_LINES     256
+#define PLAN_LINE          256
+
+static const char* const effortNames[] = { "estimate", "measure", "exhaustive" };
+
+static const int blockSizes[] = { 256, 1024, 4096, 16384 };
+#define PLAN_NUM_BLOCKS ((int)(sizeof(blockSizes)/sizeof(blockSizes[0])))
+
+int plan_parse_effort(const char* name)
+{
+    for(int k = 0; k <= PLAN_EXHAUSTIVE; k++)
+    {
+        if(!strcmp(name, effortNames[k]))
+            return k;
+    }
+    return -1;
+}
+
+const char* plan_effort_name(int effort)
+{
+    return (effort >= 0 && effort <= PLAN_EXHAUSTIVE) ? effortNames[effort] : "unknown";
+}
+
+const char* plan_default_wisdom(void)
+{
+    static char path[1024];
+    const char* home = getenv("HOME");
+#ifdef _WIN32
+    if(!home)
+        home = getenv("USERPROFILE");
+#endif
+    if(!home || !*home)
+        return NULL;
+
+    const int len = snprintf(path, sizeof(path), "%s/.reverb_wisdom", home);
+    return (len > 0 && len < (int)sizeof(path)) ? path : NULL;
+}
+
+void plan_host_name(char* name, size_t size)
+{
+    const char* env = NULL;
+
+#if defined(__unix__) || defined(__APPLE__)
+    if(gethostname(name, size) == 0)
+    {
+        name[size-1] = '\0';
+        // Keep the line format whitespace separated
+        for(char* p = name; *p; p++)
+        {
+            if(*p == ' ' || *p == '\t')
+                *p = '_';
+        }
+        if(*name)
+            return;
+    }
+#else
+    env = getenv("COMPUTERNAME");
+#endif
+
+    snprintf(name, size, "%s", env ? env : "localhost");
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Best of repeat runs over the noise, in ns per sample. < 0 if the kernel
+// is not available.
+static double timeKernel(int kernel, int block, int decimation, float modReverb,
+                         const float* x, float* wet, int n, int repeat)
+{
+    reverb_t rv;
+    double best = -1.0;
+
+    if(!reverb_setup_decimated(&rv, decimation) || !reverb_set_kernel(&rv, kernel))
+    {
+        reverb_cleanup(&rv);
+        return best;
+    }
+    reverb_set_mod(&rv, modReverb);
+
+    for(int r = 0; r < repeat; r++)
+    {
+        reverb_reset(&rv);
+
+        const double t0 = now();
+        for(int s = 0; s < n; s += block)
+        {
+            const int len = (n - s < block) ? n - s : block;
+            reverb_process_block(&rv, &x[s], &wet[s], len);
+            reverb_mix_block(30.f, &x[s], &wet[s], &wet[s], len);
+        }
+        const double t = (now() - t0) * 1e9 / n;
+
+        if(best < 0.0 || t < best)
+            best = t;
+    }
+
+    reverb_cleanup(&rv);
+
+    return best;
+}
+
+// Without timing: the per sample kernel at the block length used so far
+static void estimate(plan_t* plan)
+{
+    plan->kernel = REVERB_KERNEL_FUSED;
+    plan->block = PLAN_DEFAULT_BLOCK;
+    plan->effort = PLAN_ESTIMATE;
+    plan->nsPerSample = 0.0;
+}
+
+static void measure(plan_t* plan, int decimation, float modReverb, int effort, FILE* info)
+{
+    const int seconds = (effort == PLAN_EXHAUSTIVE) ? 2 : 1;
+    const int repeat = (effort == PLAN_EXHAUSTIVE) ? 7 : 5;
+    const int n = seconds * PLAN_SAMPLE_RATE;
+    float* x = (float*)malloc(n * sizeof(float));
+    float* wet = (float*)malloc(n * sizeof(float));
+
+    estimate(plan);
+    if(!x || !wet)
+    {
+        free(x);
+        free(wet);
+        return;
+    }
+
+    // White noise in the int16 range, same generator as the benchmark
+    uint32_t seed = 12345;
+    for(int s = 0; s < n; s++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        x[s] = ((int32_t)(seed >> 8) - (1 << 23)) * (8000.f / (1 << 23));
+    }
+
+    for(int kernel = 0; kernel < REVERB_NUM_KERNELS; kernel++)
+    {
+        // Not bit exact, only used when asked for by name
+        if(kernel == REVERB_KERNEL_SCAN)
+            continue;
+
+        for(int b = 0; b < PLAN_NUM_BLOCKS; b++)
+        {
+            if(effort != PLAN_EXHAUSTIVE && blockSizes[b] != PLAN_DEFAULT_BLOCK)
+                continue;
+
+            const double t = timeKernel(kernel, blockSizes[b], decimation, modReverb, x, wet, n, repeat);
+            if(t < 0.0)
+                continue;
+
+            fprintf(info, "plan: %-8s kernel, %5d frame blocks: %6.2f ns/sample\n",
+                    reverb_kernel_name(kernel), blockSizes[b], t);
+
+            if(plan->nsPerSample == 0.0 || t < plan->nsPerSample)
+            {
+                plan->kernel = kernel;
+                plan->block = blockSizes[b];
+                plan->nsPerSample = t;
+            }
+        }
+    }
+    plan->effort = effort;
+
+    free(wet);
+    free(x);
+}
+
+// Parse one wisdom line, the key is returned in host/decimation/modReverb
+static bool parseLine(const char* line, char* host, int* decimation, float* modReverb, plan_t* plan)
+{
+    char kernel[32];
+
+    if(sscanf(line, "%127s %d %f %d %31s %d %lf", host, decimation, modReverb,
+              &plan->effort, kernel, &plan->block, &plan->nsPerSample) != 7)
+        return false;
+
+    for(plan->kernel = 0; plan->kernel < REVERB_NUM_KERNELS; plan->kernel++)
+    {
+        if(!strcmp(kernel, reverb_kernel_name(plan->kernel)))
+            break;
+    }
+
+    return plan->kernel < REVERB_NUM_KERNELS && plan->block > 0 && plan->block <= PLAN_MAX_BLOCK &&
+           plan->effort >= PLAN_ESTIMATE && plan->effort <= PLAN_EXHAUSTIVE;
+}
+
+static bool sameKey(const char* host, int decimation, float modReverb,
+                    const char* host2, int decimation2, float modReverb2)
+{
+    return !strcmp(host, host2) && decimation == decimation2 && (int)(modReverb*1e4f + 0.5f) == (int)(modReverb2*1e4f + 0.5f);
+}
+
+// Look up the plan, false if there is none of at least effort
+static bool loadWisdom(const char* wisdom, const char* host, int decimation, float modReverb, int effort, plan_t* plan)
+{
+    char line[PLAN_LINE];
+    int version = 0;
+    bool found = false;
+
+    FILE* f = fopen(wisdom, "r");
+    if(!f)
+        return false;
+
+    if(fgets(line, sizeof(line), f) && sscanf(line, "reverb-wisdom %d", &version) == 1 &&
+       version == PLAN_WISDOM_VERSION)
+    {
+        while(!found && fgets(line, sizeof(line), f))
+        {
+            char h[128];
+            int d;
+            float m;
+            plan_t p;
+
+            if(parseLine(line, h, &d, &m, &p) && sameKey(host, decimation, modReverb, h, d, m) && p.effort >= effort)
+            {
+                *plan = p;
+                found = true;
+            }
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+// Replace or add the plan of this key. Written to a temporary file and
+// renamed, so concurrent runs never see half a file.
+static void storeWisdom(const char* wisdom, const char* host, int decimation, float modReverb, const plan_t* plan)
+{
+    static char lines[PLAN_MAX_LINES][PLAN_LINE];
+    char tmp[1100];
+    int num = 0;
+
+    FILE* f = fopen(wisdom, "r");
+    if(f)
+    {
+        char line[PLAN_LINE];
+        int version = 0;
+
+        if(fgets(line, sizeof(line), f) && sscanf(line, "reverb-wisdom %d", &version) == 1 &&
+           version == PLAN_WISDOM_VERSION)
+        {
+            while(num < PLAN_MAX_LINES - 1 && fgets(lines[num], PLAN_LINE, f))
+            {
+                char h[128];
+                int d;
+                float m;
+                plan_t p;
+
+                if(parseLine(lines[num], h, &d, &m, &p) && !sameKey(host, decimation, modReverb, h, d, m))
+                    num++;
+            }
+        }
+        fclose(f);
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    const int len = snprintf(tmp, sizeof(tmp), "%s.%d.tmp", wisdom, (int)getpid());
+#else
+    const int len = snprintf(tmp, sizeof(tmp), "%s.tmp", wisdom);
+#endif
+    if(len < 0 || len >= (int)sizeof(tmp))
+        return;
+
+    f = fopen(tmp, "w");
+    if(!f)
+        return;
+
+    fprintf(f, "reverb-wisdom %d\n", PLAN_WISDOM_VERSION);
+    for(int k = 0; k < num; k++)
+        fputs(lines[k], f);
+    fprintf(f, "%s %d %.4f %d %s %d %.3f\n", host, decimation, modReverb, plan->effort,
+            reverb_kernel_name(plan->kernel), plan->block, plan->nsPerSample);
+
+    if(fclose(f) != 0)
+    {
+        remove(tmp);
+        return;
+    }
+
+#ifdef _WIN32
+    remove(wisdom); // rename does not replace on Windows
+#endif
+    if(rename(tmp, wisdom) != 0)
+        remove(tmp);
+}
+
+void plan_create(plan_t* plan, int decimation, float modReverb, int effort, const char* wisdom, FILE* info)
+{
+    char host[128];
+
+    plan_host_name(host, sizeof(host));
+
+    if(wisdom && loadWisdom(wisdom, host, decimation, modReverb, effort, plan))
+        return;
+
+    if(effort == PLAN_ESTIMATE)
+    {
+        estimate(plan);
+        return;
+    }
+
+    measure(plan, decimation, modReverb, effort, info);
+
+    if(wisdom)
+        storeWisdom(wisdom, host, decimation, modReverb, plan);
+}
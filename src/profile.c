@@ -0,0 +1,199 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Per stage profiler, see profile.h
+*/
+
+#include "profile.h"
+
+#ifdef REVERB_PROFILE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PROF_MAX_EVENTS (1 << 20)
+
+static const char* const stageNames[PROF_NUM_STAGES] = {
+    "wav read", "read s16", "early", "decimate", "AP1", "AP2", "AP3",
+    "FFCF1", "FFCF2", "FFCF3", "FFCF4", "comb8", "velvet", "interpolate", "mix", "write s16", "wav write"
+};
+
+typedef struct prof_event
+{
+    uint64_t t0;
+    uint64_t t1;
+    int stage;  // -1 for the block itself
+} prof_event_t;
+
+int prof_active = 0;
+
+static struct
+{
+    uint64_t blocks;
+    uint64_t sampledBlocks;
+    uint64_t frames;
+    uint64_t sampledFrames;
+    uint64_t ticks;          // whole chain, all blocks
+    uint64_t sampledTicks;   // whole chain, sampled blocks
+    uint64_t stageTicks[PROF_NUM_STAGES];
+    uint64_t blockStart;
+    uint64_t firstTick;
+    double firstNs;
+    prof_event_t* events;
+    int numEvents;
+    uint64_t dropped;
+} prof;
+
+static double nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void addEvent(int stage, uint64_t t0, uint64_t t1)
+{
+    if(!prof.events)
+        prof.events = (prof_event_t*)malloc(PROF_MAX_EVENTS * sizeof(prof_event_t));
+
+    if(!prof.events || prof.numEvents == PROF_MAX_EVENTS)
+    {
+        prof.dropped++;
+        return;
+    }
+
+    prof_event_t* e = &prof.events[prof.numEvents++];
+    e->t0 = t0;
+    e->t1 = t1;
+    e->stage = stage;
+}
+
+void prof_block_begin(void)
+{
+    if(!prof.blocks)
+    {
+        prof.firstNs = nowNs();
+        prof.firstTick = prof_ticks();
+    }
+
+    prof_active = (prof.blocks % PROF_SAMPLE_EVERY) == 0;
+    prof.blockStart = prof_ticks();
+}
+
+void prof_block_end(int frames)
+{
+    const uint64_t t1 = prof_ticks();
+
+    // End of input
+    if(!frames)
+    {
+        prof_active = 0;
+        return;
+    }
+
+    const uint64_t ticks = t1 - prof.blockStart;
+
+    prof.blocks++;
+    prof.frames += frames;
+    prof.ticks += ticks;
+
+    if(prof_active)
+    {
+        prof.sampledBlocks++;
+        prof.sampledFrames += frames;
+        prof.sampledTicks += ticks;
+        addEvent(-1, prof.blockStart, t1);
+    }
+
+    prof_active = 0;
+}
+
+void prof_record(int stage, uint64_t t0)
+{
+    const uint64_t t1 = prof_ticks();
+
+    prof.stageTicks[stage] += t1 - t0;
+    addEvent(stage, t0, t1);
+}
+
+static void writeTrace(const char* trace, double nsPerTick, FILE* info)
+{
+    FILE* f = fopen(trace, "w");
+    if(!f)
+    {
+        fprintf(stderr, "Unable to write trace %s\n", trace);
+        return;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"reverb\"}}");
+    for(int k = 0; k < prof.numEvents; k++)
+    {
+        const prof_event_t* e = &prof.events[k];
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                e->stage < 0 ? "block" : stageNames[e->stage], e->stage < 0 ? "block" : "stage",
+                (e->t0 - prof.firstTick) * nsPerTick * 1e-3, (e->t1 - e->t0) * nsPerTick * 1e-3);
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    fprintf(info, "profile: %d trace events written to %s", prof.numEvents, trace);
+    if(prof.dropped)
+        fprintf(info, ", %llu dropped", (unsigned long long)prof.dropped);
+    fprintf(info, "\n");
+}
+
+void prof_report(FILE* info, const char* trace)
+{
+    if(!prof.sampledBlocks)
+        return;
+
+    // Cycle counter to wall time over the whole run
+    const double nsPerTick = (nowNs() - prof.firstNs) / (double)(prof_ticks() - prof.firstTick);
+    uint64_t stageSum = 0;
+
+    fprintf(info, "\nprofile: %llu blocks, %llu sampled (every %d), %.3f ms total, %.2f ns/sample\n",
+            (unsigned long long)prof.blocks, (unsigned long long)prof.sampledBlocks, PROF_SAMPLE_EVERY,
+            prof.ticks * nsPerTick * 1e-6, prof.ticks * nsPerTick / prof.frames);
+    fprintf(info, "profile: per stage over the sampled blocks, %.3f ns per tick\n\n", nsPerTick);
+    fprintf(info, "  %-12s %14s %12s %8s\n", "stage", "ticks/sample", "ns/sample", "share");
+
+    for(int k = 0; k < PROF_NUM_STAGES; k++)
+    {
+        stageSum += prof.stageTicks[k];
+        if(!prof.stageTicks[k])
+            continue;
+        fprintf(info, "  %-12s %14.2f %12.2f %7.1f%%\n", stageNames[k],
+                (double)prof.stageTicks[k] / prof.sampledFrames,
+                prof.stageTicks[k] * nsPerTick / prof.sampledFrames,
+                100.0 * prof.stageTicks[k] / prof.sampledTicks);
+    }
+
+    const uint64_t other = (prof.sampledTicks > stageSum) ? prof.sampledTicks - stageSum : 0;
+    fprintf(info, "  %-12s %14.2f %12.2f %7.1f%%\n", "other",
+            (double)other / prof.sampledFrames, other * nsPerTick / prof.sampledFrames,
+            100.0 * other / prof.sampledTicks);
+
+    // Sampled blocks run staged and take timestamps, the difference to the
+    // others is the cost of profiling
+    if(prof.blocks > prof.sampledBlocks)
+    {
+        const double sampled = (double)prof.sampledTicks / prof.sampledFrames;
+        const double plain = (double)(prof.ticks - prof.sampledTicks) / (prof.frames - prof.sampledFrames);
+        fprintf(info, "\nprofile: sampled blocks %.2f ns/sample, others %.2f ns/sample, overhead %.1f%%\n",
+                sampled * nsPerTick, plain * nsPerTick,
+                100.0 * (sampled - plain) * prof.sampledFrames / (plain * prof.frames));
+    }
+
+    if(trace)
+        writeTrace(trace, nsPerTick, info);
+
+    free(prof.events);
+    memset(&prof, 0, sizeof(prof));
+}
+
+#endif
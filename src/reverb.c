@@ -0,0 +1,710 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Schroeders reverb engine
+  Project is deployed on x86
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "comb8.h"
+#include "profile.h"
+#include "reverb.h"
+#include "rt.h"
+#include "telemetry.h"
+#include "velvet.h"
+#include "worker.h"
+
+const int iMAX_BUFFER_SIZE = (2*48000); // 2 seconds max reverb
+
+static const int iFFCF_DEFAULT_SIZE[REVERB_NUM_FFCF] = { 1687, 1601, 2053, 2251 };
+static const float fFFCF_GAIN[REVERB_NUM_FFCF] = { 0.773, 0.802f, 0.753f, 0.733f };
+
+static const int iAP_DEFAULT_SIZE[REVERB_NUM_AP] = { 347, 113, 37 };
+static const float fAP_GAIN[REVERB_NUM_AP] = { 0.7f, 0.7f, 0.7f };
+
+// Block length of the staged kernels, keeps the intermediate signals in L1
+#define REVERB_STAGE_BLOCK 1024
+
+static const char* const kernelNames[REVERB_NUM_KERNELS] = { "fused", "staged", "threaded", "simd", "scan" };
+static const char* const engineNames[REVERB_NUM_ENGINES] = { "schroeder", "comb8", "velvet" };
+
+bool reverb_setup(reverb_t* rv)
+{
+    return reverb_setup_decimated(rv, 1);
+}
+
+bool reverb_setup_decimated(reverb_t* rv, int decimation)
+{
+    return reverb_setup_arena(rv, decimation, NULL);
+}
+
+bool reverb_setup_arena(reverb_t* rv, int decimation, rt_arena_t* arena)
+{
+    memset(rv, 0, sizeof(*rv));
+
+    if(decimation != 1 && decimation != 2 && decimation != 4)
+        return false;
+
+    rv->arena = arena;
+    rv->decimation = decimation;
+    rv->iMaxBufferSize = iMAX_BUFFER_SIZE / decimation;
+
+    for(int k = 0; k < REVERB_NUM_AP; k++)
+    {
+        rv->fAP[k] = (float*)rt_calloc(arena, rv->iMaxBufferSize, sizeof(float));
+        if(!rv->fAP[k])
+            return false;
+    }
+
+    for(int k = 0; k < REVERB_NUM_FFCF; k++)
+    {
+        rv->fFFCF[k] = (float*)rt_calloc(arena, rv->iMaxBufferSize, sizeof(float));
+        if(!rv->fFFCF[k])
+            return false;
+    }
+
+    reverb_set_mod(rv, 0.f);
+    reverb_reset(rv);
+
+    return true;
+}
+
+void reverb_reset(reverb_t* rv)
+{
+    for(int k = 0; k < REVERB_NUM_AP; k++)
+    {
+        memset(rv->fAP[k], 0, (rv->iAP_BUFFER_SIZE[k] + 1) * sizeof(float));
+        rv->iAP[k] = 0;
+    }
+
+    for(int k = 0; k < REVERB_NUM_FFCF; k++)
+    {
+        memset(rv->fFFCF[k], 0, (rv->iFFCF_BUFFER_SIZE[k] + 1) * sizeof(float));
+        rv->iFFCF[k] = 0;
+    }
+
+    for(int k = 0; k < 2; k++)
+    {
+        halfband_dec_init(&rv->dec[k]);
+        halfband_int_init(&rv->interp[k]);
+    }
+
+    // The first wet sample leaves the interpolator after decimation inputs
+    memset(rv->fQueue, 0, sizeof(rv->fQueue));
+    rv->iQueueCount = rv->decimation - 1;
+
+    if(rv->fComb8)
+        comb8_reset(rv);
+    if(rv->fVelvet)
+        velvet_reset(rv);
+}
+
+void reverb_cleanup(reverb_t* rv)
+{
+    reverb_set_kernel(rv, REVERB_KERNEL_FUSED);
+    reverb_enable_telemetry(rv, false);
+    comb8_cleanup(rv);
+    velvet_cleanup(rv);
+
+    for(int k = 0; k < REVERB_NUM_FFCF; k++)
+    {
+        if(rv->fFFCF[k])
+            rt_free(rv->arena, rv->fFFCF[k]);
+        rv->fFFCF[k] = NULL;
+    }
+
+    for(int k = 0; k < REVERB_NUM_AP; k++)
+    {
+        if(rv->fAP[k])
+            rt_free(rv->arena, rv->fAP[k]);
+        rv->fAP[k] = NULL;
+    }
+}
+
+size_t reverb_memory_size(int decimation, int engine)
+{
+    const size_t line = rt_arena_bytes((iMAX_BUFFER_SIZE / decimation) * sizeof(float));
+    size_t size = (REVERB_NUM_AP + REVERB_NUM_FFCF) * line + rt_arena_bytes(sizeof(telemetry_t));
+
+    if(engine == REVERB_ENGINE_COMB8)
+        size += comb8_memory_size(decimation);
+    else if(engine == REVERB_ENGINE_VELVET)
+        size += velvet_memory_size(decimation);
+
+    return size;
+}
+
+bool reverb_set_kernel(reverb_t* rv, int kernel)
+{
+    if(kernel < 0 || kernel >= REVERB_NUM_KERNELS)
+        return false;
+
+    if(kernel == REVERB_KERNEL_THREADED && !rv->worker)
+    {
+        rv->worker = worker_create();
+        if(!rv->worker)
+            return false;
+    }
+    else if(kernel != REVERB_KERNEL_THREADED && rv->worker)
+    {
+        worker_destroy(rv->worker);
+        rv->worker = NULL;
+    }
+
+    rv->kernel = kernel;
+
+    return true;
+}
+
+bool reverb_enable_telemetry(reverb_t* rv, bool enable)
+{
+    if(enable && !rv->telemetry)
+    {
+        rv->telemetry = (telemetry_t*)rt_calloc(rv->arena, 1, sizeof(telemetry_t));
+        return rv->telemetry != NULL;
+    }
+
+    if(!enable && rv->telemetry)
+    {
+        rt_free(rv->arena, rv->telemetry);
+        rv->telemetry = NULL;
+    }
+
+    return true;
+}
+
+const char* reverb_kernel_name(int kernel)
+{
+    return (kernel >= 0 && kernel < REVERB_NUM_KERNELS) ? kernelNames[kernel] : "unknown";
+}
+
+bool reverb_set_engine(reverb_t* rv, int engine)
+{
+    if(engine < 0 || engine >= REVERB_NUM_ENGINES)
+        return false;
+
+    if(engine == REVERB_ENGINE_COMB8 && !rv->fComb8 && !comb8_setup(rv))
+        return false;
+    if(engine == REVERB_ENGINE_VELVET && !rv->fVelvet && !velvet_setup(rv))
+        return false;
+
+    rv->engine = engine;
+
+    return true;
+}
+
+const char* reverb_engine_name(int engine)
+{
+    return (engine >= 0 && engine < REVERB_NUM_ENGINES) ? engineNames[engine] : "unknown";
+}
+
+// The line keeps its memory: a longer delay exposes samples left from an
+// earlier, longer setting, a shorter one may leave the index past the end
+static void resizeLine(float* line, int* index, int* iBufsize, int size)
+{
+    if(size > *iBufsize)
+        memset(&line[*iBufsize + 1], 0, (size - *iBufsize) * sizeof(float));
+    if(*index > size)
+        *index = 0;
+    *iBufsize = size;
+}
+
+void reverb_set_mod(reverb_t* rv, float modReverb)
+{
+    rv->modReverb = modReverb;
+
+    for(int k = 0; k < REVERB_NUM_FFCF; k++)
+        resizeLine(rv->fFFCF[k], &rv->iFFCF[k], &rv->iFFCF_BUFFER_SIZE[k],
+                   (int)(expf(2.9 * modReverb) * iFFCF_DEFAULT_SIZE[k]) / rv->decimation);
+
+    for(int k = 0; k < REVERB_NUM_AP; k++)
+        resizeLine(rv->fAP[k], &rv->iAP[k], &rv->iAP_BUFFER_SIZE[k],
+                   (int)(expf(2.9 * modReverb) * iAP_DEFAULT_SIZE[k]) / rv->decimation);
+
+    if(rv->fComb8)
+        comb8_set_mod(rv);
+    if(rv->fVelvet)
+        velvet_set_mod(rv);
+}
+
+// Process a all pass
+float processAP(float x, float g, float* state, int* i, int iBufsize)
+{
+    float y;
+    int index = *i;
+
+    y = -g * x + state[index];
+    y *= (1 - g*g); // Added due to high gain -> clipping
+
+    state[index] = g * state[(index-1+iBufsize)%iBufsize] + g * x;//x;//g * x;//
+
+    if(++index > iBufsize)
+        index = 0;
+
+    *i = index;
+
+    return hardClip(y);
+}
+
+// Process a feed backwards comb filer
+float processFBCF(float x, float g, float* state, int* i, int iBufsize)
+{
+    float y;
+    int index = *i;
+
+    y = x + g * state[index];
+    state[index] = y;
+
+    if(++index > iBufsize)
+        index = 0;
+
+    *i = index;
+
+    return hardClip(y);
+}
+
+// Process a feed forward comb filer
+float processFFCF(float x, float g, float* state, int* i, int iBufsize)
+{
+    float y;
+    int index = *i;
+
+    y = g * x + g * state[index];
+
+    state[index] = x;
+
+    if(++index > iBufsize)
+        index = 0;
+
+    *i = index;
+
+    return hardClip(y);
+}
+
+// Process mixing matrix
+float processMM(float x1, float x2, float x3, float x4)
+{
+    float s1, s2;
+    s1 = x1 + x3;
+    s2 = x2 + x4;
+
+    float OutA, OutB, OutC, OutD;
+
+    // Different reverb combinations
+    OutA = s1 + s2;
+    OutB = -OutA;
+    OutD = s1 - s2;
+    OutC = -OutD;
+
+    return hardClip(OutA);
+}
+
+static inline float processNetwork(reverb_t* rv, float x)
+{
+    float ap = x;
+
+    ap = processAP(ap, fAP_GAIN[0], rv->fAP[0], &rv->iAP[0], rv->iAP_BUFFER_SIZE[0]);
+    ap = processAP(ap, fAP_GAIN[1], rv->fAP[1], &rv->iAP[1], rv->iAP_BUFFER_SIZE[1]);
+    ap = processAP(ap, fAP_GAIN[2], rv->fAP[2], &rv->iAP[2], rv->iAP_BUFFER_SIZE[2]);
+
+    float fOutput = processFFCF(ap, fFFCF_GAIN[0], rv->fFFCF[0], &rv->iFFCF[0], rv->iFFCF_BUFFER_SIZE[0]);
+    fOutput = hardClip(fOutput + processFFCF(ap, fFFCF_GAIN[1], rv->fFFCF[1], &rv->iFFCF[1], rv->iFFCF_BUFFER_SIZE[1]));
+    fOutput = hardClip(fOutput + processFFCF(ap, fFFCF_GAIN[2], rv->fFFCF[2], &rv->iFFCF[2], rv->iFFCF_BUFFER_SIZE[2]));
+    fOutput = hardClip(fOutput + processFFCF(ap, fFFCF_GAIN[3], rv->fFFCF[3], &rv->iFFCF[3], rv->iFFCF_BUFFER_SIZE[3]));
+
+    return fOutput;
+}
+
+typedef struct comb_task
+{
+    reverb_t* rv;
+    const float* ap;
+    float (*comb)[REVERB_STAGE_BLOCK];
+    int first;  // runs the combs first and first + 1
+    int n;
+    bool simd;
+} comb_task_t;
+
+static void processCombs(void* arg)
+{
+    comb_task_t* t = (comb_task_t*)arg;
+    reverb_t* rv = t->rv;
+
+    for(int k = t->first; k < t->first + 2; k++)
+    {
+        uint64_t t0 = PROF_START();
+        if(t->simd)
+        {
+            processFFCFBlock(t->ap, t->comb[k], t->n, fFFCF_GAIN[k], rv->fFFCF[k], &rv->iFFCF[k], rv->iFFCF_BUFFER_SIZE[k]);
+        }
+        else
+        {
+            for(int s = 0; s < t->n; s++)
+                t->comb[k][s] = processFFCF(t->ap[s], fFFCF_GAIN[k], rv->fFFCF[k], &rv->iFFCF[k], rv->iFFCF_BUFFER_SIZE[k]);
+        }
+        PROF_STOP(PROF_FFCF1 + k, t0);
+    }
+}
+
+// Per sample unless kernel is REVERB_KERNEL_SIMD or REVERB_KERNEL_SCAN
+static void processAllpasses(reverb_t* rv, float* ap, int n, int kernel)
+{
+    telemetry_t* tm = rv->telemetry;
+
+    for(int k = 0; k < REVERB_NUM_AP; k++)
+    {
+        uint64_t t0 = PROF_START();
+        if(kernel == REVERB_KERNEL_SCAN)
+        {
+            processAPBlockScan(ap, ap, n, fAP_GAIN[k], rv->fAP[k], &rv->iAP[k], rv->iAP_BUFFER_SIZE[k]);
+        }
+        else if(kernel == REVERB_KERNEL_SIMD)
+        {
+            processAPBlock(ap, ap, n, fAP_GAIN[k], rv->fAP[k], &rv->iAP[k], rv->iAP_BUFFER_SIZE[k]);
+        }
+        else
+        {
+            for(int s = 0; s < n; s++)
+                ap[s] = processAP(ap[s], fAP_GAIN[k], rv->fAP[k], &rv->iAP[k], rv->iAP_BUFFER_SIZE[k]);
+        }
+        PROF_STOP(PROF_AP1 + k, t0);
+
+        if(tm)
+            tm->cur.clips[TELEMETRY_AP1 + k] += telemetry_clips(ap, n);
+    }
+}
+
+// Same arithmetic as processNetwork() in the same order, but each stage
+// runs over the whole block with only one delay line in use at a time.
+// Profiled blocks keep all stages on this thread.
+static void processStaged(reverb_t* rv, const float* in, float* out, int n)
+{
+    float ap[REVERB_STAGE_BLOCK];
+    float comb[REVERB_NUM_FFCF][REVERB_STAGE_BLOCK];
+    worker_t* worker = prof_active ? NULL : rv->worker;
+    telemetry_t* tm = rv->telemetry;
+    const bool simd = (rv->kernel == REVERB_KERNEL_SIMD) || (rv->kernel == REVERB_KERNEL_SCAN);
+    const float* const combs[REVERB_NUM_FFCF] = { comb[0], comb[1], comb[2], comb[3] };
+
+    while(n > 0)
+    {
+        const int len = (n < REVERB_STAGE_BLOCK) ? n : REVERB_STAGE_BLOCK;
+        comb_task_t low = { rv, ap, comb, 0, len, simd };
+        comb_task_t high = { rv, ap, comb, 2, len, simd };
+
+        memcpy(ap, in, len * sizeof(float));
+        processAllpasses(rv, ap, len, rv->kernel);
+
+        if(worker)
+        {
+            worker_start(worker, processCombs, &high);
+            processCombs(&low);
+            worker_wait(worker);
+        }
+        else
+        {
+            processCombs(&low);
+            processCombs(&high);
+        }
+
+        if(simd)
+        {
+            processCombSum(combs, out, len);
+        }
+        else
+        {
+            for(int s = 0; s < len; s++)
+                out[s] = hardClip(hardClip(hardClip(comb[0][s] + comb[1][s]) + comb[2][s]) + comb[3][s]);
+        }
+
+        if(tm)
+        {
+            for(int k = 0; k < REVERB_NUM_FFCF; k++)
+                tm->cur.clips[TELEMETRY_FFCF1 + k] += telemetry_clips(comb[k], len);
+            tm->cur.clips[TELEMETRY_COMBS] += telemetry_clips(out, len);
+        }
+
+        in += len;
+        out += len;
+        n -= len;
+    }
+}
+
+// Vector allpasses into the damped comb bank
+static void processComb8Network(reverb_t* rv, const float* in, float* out, int n)
+{
+    float ap[REVERB_STAGE_BLOCK];
+    telemetry_t* tm = rv->telemetry;
+
+    while(n > 0)
+    {
+        const int len = (n < REVERB_STAGE_BLOCK) ? n : REVERB_STAGE_BLOCK;
+
+        memcpy(ap, in, len * sizeof(float));
+        processAllpasses(rv, ap, len, REVERB_KERNEL_SIMD);
+
+        uint64_t t0 = PROF_START();
+        comb8_process(rv, ap, out, len);
+        PROF_STOP(PROF_COMB8, t0);
+
+        if(tm)
+            tm->cur.clips[TELEMETRY_COMBS] += telemetry_clips(out, len);
+
+        in += len;
+        out += len;
+        n -= len;
+    }
+}
+
+// Vector allpasses into the velvet convolution, bit exact like comb8
+static void processVelvetNetwork(reverb_t* rv, const float* in, float* out, int n)
+{
+    float ap[REVERB_STAGE_BLOCK];
+    telemetry_t* tm = rv->telemetry;
+
+    while(n > 0)
+    {
+        const int len = (n < REVERB_STAGE_BLOCK) ? n : REVERB_STAGE_BLOCK;
+
+        memcpy(ap, in, len * sizeof(float));
+        processAllpasses(rv, ap, len, REVERB_KERNEL_SIMD);
+
+        uint64_t t0 = PROF_START();
+        velvet_process(rv, ap, out, len);
+        PROF_STOP(PROF_VELVET, t0);
+
+        if(tm)
+            tm->cur.clips[TELEMETRY_COMBS] += telemetry_clips(out, len);
+
+        in += len;
+        out += len;
+        n -= len;
+    }
+}
+
+// in and out may be the same buffer
+static void processNetworkBlock(reverb_t* rv, const float* in, float* out, int n)
+{
+    if(rv->engine == REVERB_ENGINE_COMB8)
+    {
+        processComb8Network(rv, in, out, n);
+        return;
+    }
+    if(rv->engine == REVERB_ENGINE_VELVET)
+    {
+        processVelvetNetwork(rv, in, out, n);
+        return;
+    }
+
+    // Telemetry needs the output of every stage
+    if(rv->kernel != REVERB_KERNEL_FUSED || prof_active || rv->telemetry)
+    {
+        processStaged(rv, in, out, n);
+        return;
+    }
+
+    for(int s = 0; s < n; s++)
+        out[s] = processNetwork(rv, in[s]);
+}
+
+static void processDecimated(reverb_t* rv, const float* in, float* wet, int n)
+{
+    float low[HALFBAND_MAX_BLOCK/2 + 2];
+    float low2[HALFBAND_MAX_BLOCK/4 + 2];
+    float up[REVERB_MAX_DECIMATION + HALFBAND_MAX_BLOCK];
+
+    while(n > 0)
+    {
+        const int len = (n < HALFBAND_MAX_BLOCK) ? n : HALFBAND_MAX_BLOCK;
+        float* net = low;
+        uint64_t t0 = PROF_START();
+        int num = halfband_decimate(&rv->dec[0], in, len, low);
+
+        if(rv->decimation == 4)
+        {
+            num = halfband_decimate(&rv->dec[1], low, num, low2);
+            net = low2;
+        }
+        PROF_STOP(PROF_DECIMATE, t0);
+
+        processNetworkBlock(rv, net, net, num);
+
+        // Wet samples left over from the previous call come first
+        t0 = PROF_START();
+        const int queued = rv->iQueueCount;
+        memcpy(up, rv->fQueue, queued * sizeof(float));
+
+        if(rv->decimation == 2)
+        {
+            halfband_interpolate(&rv->interp[0], net, num, &up[queued]);
+        }
+        else
+        {
+            halfband_interpolate(&rv->interp[1], net, num, low);
+            halfband_interpolate(&rv->interp[0], low, 2*num, &up[queued]);
+        }
+
+        for(int s = 0; s < len; s++)
+            wet[s] = hardClip(up[s]);
+
+        rv->iQueueCount = queued + rv->decimation * num - len;
+        memcpy(rv->fQueue, &up[len], rv->iQueueCount * sizeof(float));
+        PROF_STOP(PROF_INTERPOLATE, t0);
+
+        in += len;
+        wet += len;
+        n -= len;
+    }
+}
+
+static void updateTelemetry(reverb_t* rv, const float* in, const float* wet, int n)
+{
+    telemetry_t* tm = rv->telemetry;
+    double energy;
+
+    tm->cur.blocks++;
+    tm->cur.frames += n;
+    tm->cur.clips[TELEMETRY_WET] += telemetry_clips(wet, n);
+
+    telemetry_peak_energy(in, n, &tm->cur.peakIn, &energy);
+    tm->cur.rmsIn = (n > 0) ? sqrtf(energy / n) : 0.f;
+    telemetry_peak_energy(wet, n, &tm->cur.peakWet, &energy);
+    tm->cur.rmsWet = (n > 0) ? sqrtf(energy / n) : 0.f;
+    tm->cur.lineEnergy = reverb_line_energy(rv);
+
+    telemetry_publish(tm);
+}
+
+void reverb_process_block(reverb_t* rv, const float* in, float* wet, int n)
+{
+    if(rv->decimation > 1)
+        processDecimated(rv, in, wet, n);
+    else
+        processNetworkBlock(rv, in, wet, n);
+
+    if(rv->telemetry)
+        updateTelemetry(rv, in, wet, n);
+}
+
+double reverb_line_energy(const reverb_t* rv)
+{
+    float peak;
+    double energy;
+
+    reverb_line_peak_energy(rv, &peak, &energy);
+
+    return energy;
+}
+
+void reverb_line_peak_energy(const reverb_t* rv, float* peak, double* energy)
+{
+    double sum;
+    float p;
+
+    *peak = 0.f;
+    *energy = 0.0;
+
+    for(int k = 0; k < REVERB_NUM_AP; k++)
+    {
+        telemetry_peak_energy(rv->fAP[k], rv->iAP_BUFFER_SIZE[k] + 1, &p, &sum);
+        *peak = fmaxf(*peak, p);
+        *energy += sum;
+    }
+
+    // The FFCF lines only belong to the Schroeder network
+    if(rv->engine == REVERB_ENGINE_COMB8)
+    {
+        comb8_peak_energy(rv, &p, &sum);
+        *peak = fmaxf(*peak, p);
+        *energy += sum;
+    }
+    else if(rv->engine == REVERB_ENGINE_VELVET)
+    {
+        velvet_peak_energy(rv, &p, &sum);
+        *peak = fmaxf(*peak, p);
+        *energy += sum;
+    }
+    else
+    {
+        for(int k = 0; k < REVERB_NUM_FFCF; k++)
+        {
+            telemetry_peak_energy(rv->fFFCF[k], rv->iFFCF_BUFFER_SIZE[k] + 1, &p, &sum);
+            *peak = fmaxf(*peak, p);
+            *energy += sum;
+        }
+    }
+}
+
+void reverb_mix_block(float dryWet, const float* in, const float* wet, float* out, int n)
+{
+    const float fWet = dryWet/100.f;
+    const float fDry = 1.f - dryWet/100.f;
+
+    for(int s = 0; s < n; s++)
+    {
+        float fOutput = wet[s] * fWet;
+        fOutput += fDry * in[s];
+        out[s] = fOutput;
+    }
+}
+
+void reverb_mix_block_ramp(const float* dryWet, const float* in, const float* wet, float* out, int n)
+{
+    for(int s = 0; s < n; s++)
+    {
+        const float fWet = dryWet[s]/100.f;
+        const float fDry = 1.f - dryWet[s]/100.f;
+
+        float fOutput = wet[s] * fWet;
+        fOutput += fDry * in[s];
+        out[s] = fOutput;
+    }
+}
+
+void reverb_read_s16(const uint8_t* in, float* out, int frames, int channels)
+{
+    for(int s = 0; s < frames; s++)
+    {
+        const uint8_t* p = &in[2*channels*s];
+        int32_t inL = (int16_t)(p[0] | (p[1] << 8));
+        int32_t inR = inL;
+
+        // interleaved left right channel
+        if(channels > 1)
+            inR = (int16_t)(p[2] | (p[3] << 8));
+
+        out[s] = (inL + inR) * 0.5f;
+    }
+}
+
+void reverb_write_s16(const float* in, int16_t* out, int frames, int channels)
+{
+    for(int s = 0; s < frames; s++)
+    {
+        for(int c = 0; c < channels; c++)
+            out[channels*s + c] = (int16_t)in[s];
+    }
+}
+
+void reverb_write_s16_stereo(const float* left, const float* right, int16_t* out, int frames, int channels)
+{
+    for(int s = 0; s < frames; s++)
+    {
+        if(channels == 1)
+        {
+            out[s] = (int16_t)((left[s] + right[s]) * 0.5f);
+            continue;
+        }
+
+        out[channels*s] = (int16_t)left[s];
+        out[channels*s + 1] = (int16_t)right[s];
+        for(int c = 2; c < channels; c++)
+            out[channels*s + c] = (int16_t)((left[s] + right[s]) * 0.5f);
+    }
+}
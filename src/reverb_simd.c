@@ -0,0 +1,241 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Block versions of the AP and comb filters on simd.h. Within one pass
+  over a delay line no position is read after it was written, so each
+  contiguous run up to the wrap can be processed in vectors. The results
+  are identical to processAP(), processFBCF() and processFFCF() called per
+  sample, except for processAPBlockScan().
+*/
+
+#include "reverb.h"
+#include "simd.h"
+
+// Samples until index passes iBufsize, at most n
+static inline int runLength(int index, int iBufsize, int n)
+{
+    const int run = iBufsize + 1 - index;
+    return (run < n) ? run : n;
+}
+
+void processAPBlock(const float* x, float* y, int n, float g, float* state, int* i, int iBufsize)
+{
+    const vf_t vng = vf_set1(-g);
+    const vf_t vk = vf_set1(1 - g*g);
+    const vf_t lo = vf_set1(MIN_SMP_VAL);
+    const vf_t hi = vf_set1(MAX_SMP_VAL);
+    int index = *i;
+
+    while(n > 0)
+    {
+        const int run = runLength(index, iBufsize, n);
+        float* line = &state[index];
+        float prev = state[(index-1+iBufsize)%iBufsize];
+        int s = 0;
+
+        // The output only reads old line values, the recursion of the line
+        // itself stays scalar. x and y may be the same buffer.
+        for(; s + SIMD_LANES <= run; s += SIMD_LANES)
+        {
+            const vf_t vx = vf_loadu(&x[s]);
+            const vf_t vy = vf_clamp((vng * vx + vf_loadu(&line[s])) * vk, lo, hi);
+
+            for(int l = 0; l < SIMD_LANES; l++)
+            {
+                line[s + l] = g * prev + g * vx[l];
+                prev = line[s + l];
+            }
+
+            vf_storeu(&y[s], vy);
+        }
+
+        for(; s < run; s++)
+        {
+            const float xs = x[s];
+            float ys = -g * xs + line[s];
+            ys *= (1 - g*g);
+
+            line[s] = g * prev + g * xs;
+            prev = line[s];
+
+            y[s] = hardClip(ys);
+        }
+
+        index += run;
+        if(index > iBufsize)
+            index = 0;
+
+        x += run;
+        y += run;
+        n -= run;
+    }
+
+    *i = index;
+}
+
+// The line recursion w[s] = g*w[s-1] + g*x[s] as a prefix scan over the
+// lanes: after the log2(SIMD_LANES) steps u[l] holds the sum of
+// g^(l-j) * g*x[j] over the lanes j <= l, the carry from the previous
+// vector adds g^(l+1) * w[-1]. Only that carry is serial.
+void processAPBlockScan(const float* x, float* y, int n, float g, float* state, int* i, int iBufsize)
+{
+    const vf_t vg = vf_set1(g);
+    const vf_t vng = vf_set1(-g);
+    const vf_t vk = vf_set1(1 - g*g);
+    const vf_t lo = vf_set1(MIN_SMP_VAL);
+    const vf_t hi = vf_set1(MAX_SMP_VAL);
+    vf_t vstep[4]; // g^1, g^2, g^4, g^8
+    vf_t vcarry;   // g^(l+1)
+    int index = *i;
+
+    float p = g;
+    for(int k = 0; k < 4; k++, p *= p)
+        vstep[k] = vf_set1(p);
+    p = g;
+    for(int l = 0; l < SIMD_LANES; l++, p *= g)
+        vcarry[l] = p;
+
+    while(n > 0)
+    {
+        const int run = runLength(index, iBufsize, n);
+        float* line = &state[index];
+        float prev = state[(index-1+iBufsize)%iBufsize];
+        int s = 0;
+
+        for(; s + SIMD_LANES <= run; s += SIMD_LANES)
+        {
+            const vf_t vx = vf_loadu(&x[s]);
+            const vf_t vy = vf_clamp((vng * vx + vf_loadu(&line[s])) * vk, lo, hi);
+            vf_t w = vg * vx;
+
+            for(int k = 1, j = 0; k < SIMD_LANES; k *= 2, j++)
+                w = vf_madd(vstep[j], vf_shift_up(w, k), w);
+            w = vf_madd(vcarry, vf_set1(prev), w);
+
+            vf_storeu(&line[s], w);
+            prev = w[SIMD_LANES - 1];
+
+            vf_storeu(&y[s], vy);
+        }
+
+        for(; s < run; s++)
+        {
+            const float xs = x[s];
+            float ys = -g * xs + line[s];
+            ys *= (1 - g*g);
+
+            line[s] = g * prev + g * xs;
+            prev = line[s];
+
+            y[s] = hardClip(ys);
+        }
+
+        index += run;
+        if(index > iBufsize)
+            index = 0;
+
+        x += run;
+        y += run;
+        n -= run;
+    }
+
+    *i = index;
+}
+
+void processFBCFBlock(const float* x, float* y, int n, float g, float* state, int* i, int iBufsize)
+{
+    const vf_t vg = vf_set1(g);
+    const vf_t lo = vf_set1(MIN_SMP_VAL);
+    const vf_t hi = vf_set1(MAX_SMP_VAL);
+    int index = *i;
+
+    while(n > 0)
+    {
+        const int run = runLength(index, iBufsize, n);
+        float* line = &state[index];
+        int s = 0;
+
+        for(; s + SIMD_LANES <= run; s += SIMD_LANES)
+        {
+            const vf_t v = vf_madd(vg, vf_loadu(&line[s]), vf_loadu(&x[s]));
+            vf_storeu(&line[s], v);
+            vf_storeu(&y[s], vf_clamp(v, lo, hi));
+        }
+
+        for(; s < run; s++)
+        {
+            const float v = x[s] + g * line[s];
+            line[s] = v;
+            y[s] = hardClip(v);
+        }
+
+        index += run;
+        if(index > iBufsize)
+            index = 0;
+
+        x += run;
+        y += run;
+        n -= run;
+    }
+
+    *i = index;
+}
+
+void processFFCFBlock(const float* x, float* y, int n, float g, float* state, int* i, int iBufsize)
+{
+    const vf_t vg = vf_set1(g);
+    const vf_t lo = vf_set1(MIN_SMP_VAL);
+    const vf_t hi = vf_set1(MAX_SMP_VAL);
+    int index = *i;
+
+    while(n > 0)
+    {
+        const int run = runLength(index, iBufsize, n);
+        float* line = &state[index];
+        int s = 0;
+
+        for(; s + SIMD_LANES <= run; s += SIMD_LANES)
+        {
+            const vf_t vx = vf_loadu(&x[s]);
+            vf_storeu(&y[s], vf_clamp(vf_madd(vg, vx, vg * vf_loadu(&line[s])), lo, hi));
+            vf_storeu(&line[s], vx);
+        }
+
+        for(; s < run; s++)
+        {
+            const float xs = x[s];
+            y[s] = hardClip(g * xs + g * line[s]);
+            line[s] = xs;
+        }
+
+        index += run;
+        if(index > iBufsize)
+            index = 0;
+
+        x += run;
+        y += run;
+        n -= run;
+    }
+
+    *i = index;
+}
+
+void processCombSum(const float* const comb[REVERB_NUM_FFCF], float* y, int n)
+{
+    const vf_t lo = vf_set1(MIN_SMP_VAL);
+    const vf_t hi = vf_set1(MAX_SMP_VAL);
+    int s = 0;
+
+    for(; s + SIMD_LANES <= n; s += SIMD_LANES)
+    {
+        vf_t v = vf_clamp(vf_loadu(&comb[0][s]) + vf_loadu(&comb[1][s]), lo, hi);
+        v = vf_clamp(v + vf_loadu(&comb[2][s]), lo, hi);
+        vf_storeu(&y[s], vf_clamp(v + vf_loadu(&comb[3][s]), lo, hi));
+    }
+
+    for(; s < n; s++)
+        y[s] = hardClip(hardClip(hardClip(comb[0][s] + comb[1][s]) + comb[2][s]) + comb[3][s]);
+}
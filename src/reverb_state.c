@@ -0,0 +1,282 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Save and restore the reverb engine state, e.g. to continue a render in
+  chunks. All values are stored little endian:
+
+    "RVST" version numAP numFFCF dryWet modReverb decimation engine
+    per stage (APs first, then FFCFs):
+      delay length, index, (delay length + 1) delay line samples
+    if engine is REVERB_ENGINE_COMB8:
+      rows, write row, per lane delay and lowpass state, rows * 8 samples
+    if engine is REVERB_ENGINE_VELVET:
+      rows, write position, rows samples of input history
+    if decimation > 1:
+      half-band decimator and interpolator histories, queued wet samples
+
+  Only the used part of each delay line is stored, index wraps after
+  reaching the delay length so it spans length + 1 samples. Version 1
+  files have no decimation field and load as decimation 1, version 1 and 2
+  files have no engine field and load as REVERB_ENGINE_SCHROEDER. The
+  velvet pulses follow from modReverb and are not stored.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "reverb.h"
+#include "velvet.h"
+
+#define STATE_VERSION 4
+
+static void write_u32(FILE* f, uint32_t value)
+{
+    fputc((value >>  0) & 0xff, f);
+    fputc((value >>  8) & 0xff, f);
+    fputc((value >> 16) & 0xff, f);
+    fputc((value >> 24) & 0xff, f);
+}
+
+static void write_float(FILE* f, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    write_u32(f, bits);
+}
+
+static bool read_u32(FILE* f, uint32_t* value)
+{
+    uint8_t b[4];
+    if(fread(b, 1, 4, f) != 4)
+        return false;
+    *value = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+    return true;
+}
+
+static bool read_float(FILE* f, float* value)
+{
+    uint32_t bits;
+    if(!read_u32(f, &bits))
+        return false;
+    memcpy(value, &bits, sizeof(bits));
+    return true;
+}
+
+static void write_line(FILE* f, const float* state, int index, int iBufsize)
+{
+    write_u32(f, iBufsize);
+    write_u32(f, index);
+    for(int k = 0; k <= iBufsize; k++)
+        write_float(f, state[k]);
+}
+
+static bool read_line(FILE* f, float* state, int* index, int* iBufsize, int iMaxBufferSize)
+{
+    uint32_t size, idx;
+
+    if(!read_u32(f, &size) || !read_u32(f, &idx))
+        return false;
+    if(size == 0 || size >= (uint32_t)iMaxBufferSize || idx > size)
+        return false;
+
+    for(uint32_t k = 0; k <= size; k++)
+    {
+        if(!read_float(f, &state[k]))
+            return false;
+    }
+
+    *iBufsize = size;
+    *index = idx;
+    return true;
+}
+
+static void write_floats(FILE* f, const float* values, int num)
+{
+    for(int k = 0; k < num; k++)
+        write_float(f, values[k]);
+}
+
+static bool read_floats(FILE* f, float* values, int num)
+{
+    for(int k = 0; k < num; k++)
+    {
+        if(!read_float(f, &values[k]))
+            return false;
+    }
+    return true;
+}
+
+static void write_multirate(FILE* f, const reverb_t* rv)
+{
+    for(int k = 0; k < 2; k++)
+    {
+        write_floats(f, rv->dec[k].hist, HALFBAND_LEN-1);
+        write_u32(f, rv->dec[k].phase);
+        write_floats(f, rv->interp[k].hist, 2*HALFBAND_PAIRS-1);
+    }
+    write_u32(f, rv->iQueueCount);
+    write_floats(f, rv->fQueue, rv->iQueueCount);
+}
+
+static bool read_multirate(FILE* f, reverb_t* rv)
+{
+    uint32_t phase, count;
+
+    for(int k = 0; k < 2; k++)
+    {
+        if(!read_floats(f, rv->dec[k].hist, HALFBAND_LEN-1))
+            return false;
+        if(!read_u32(f, &phase) || phase > 1)
+            return false;
+        rv->dec[k].phase = phase;
+
+        if(!read_floats(f, rv->interp[k].hist, 2*HALFBAND_PAIRS-1))
+            return false;
+    }
+
+    if(!read_u32(f, &count) || count >= REVERB_MAX_DECIMATION)
+        return false;
+    rv->iQueueCount = count;
+
+    return read_floats(f, rv->fQueue, count);
+}
+
+static void write_comb8(FILE* f, const reverb_t* rv)
+{
+    write_u32(f, rv->iComb8Mask + 1);
+    write_u32(f, rv->iComb8Write);
+    for(int l = 0; l < REVERB_COMB8_LANES; l++)
+        write_u32(f, rv->iComb8Delay[l]);
+    write_floats(f, rv->fComb8Filter, REVERB_COMB8_LANES);
+    write_floats(f, rv->fComb8, (rv->iComb8Mask + 1) * REVERB_COMB8_LANES);
+}
+
+static bool read_comb8(FILE* f, reverb_t* rv)
+{
+    uint32_t rows, write, delay;
+
+    // The line length follows from the decimation, same as the other lines
+    if(!read_u32(f, &rows) || rows != (uint32_t)rv->iComb8Mask + 1)
+        return false;
+    if(!read_u32(f, &write) || write >= rows)
+        return false;
+    rv->iComb8Write = write;
+
+    for(int l = 0; l < REVERB_COMB8_LANES; l++)
+    {
+        if(!read_u32(f, &delay) || delay == 0 || delay >= rows)
+            return false;
+        rv->iComb8Delay[l] = delay;
+    }
+
+    return read_floats(f, rv->fComb8Filter, REVERB_COMB8_LANES) &&
+           read_floats(f, rv->fComb8, rows * REVERB_COMB8_LANES);
+}
+
+static void write_velvet(FILE* f, const reverb_t* rv)
+{
+    write_u32(f, rv->iVelvetMask + 1);
+    write_u32(f, rv->iVelvetWrite);
+    write_floats(f, rv->fVelvet, rv->iVelvetMask + 1);
+}
+
+static bool read_velvet(FILE* f, reverb_t* rv)
+{
+    const int rows = rv->iVelvetMask + 1;
+    uint32_t count, write;
+
+    if(!read_u32(f, &count) || count != (uint32_t)rows)
+        return false;
+    if(!read_u32(f, &write) || write >= count)
+        return false;
+    rv->iVelvetWrite = write;
+
+    if(!read_floats(f, rv->fVelvet, rows))
+        return false;
+    memcpy(&rv->fVelvet[rows], rv->fVelvet, rows * sizeof(float));
+    velvet_set_mod(rv);
+
+    return true;
+}
+
+bool reverb_save_state(const reverb_t* rv, FILE* f)
+{
+    fwrite("RVST", 1, 4, f);
+    write_u32(f, STATE_VERSION);
+    write_u32(f, REVERB_NUM_AP);
+    write_u32(f, REVERB_NUM_FFCF);
+    write_float(f, rv->dryWet);
+    write_float(f, rv->modReverb);
+    write_u32(f, rv->decimation);
+    write_u32(f, rv->engine);
+
+    for(int k = 0; k < REVERB_NUM_AP; k++)
+        write_line(f, rv->fAP[k], rv->iAP[k], rv->iAP_BUFFER_SIZE[k]);
+
+    for(int k = 0; k < REVERB_NUM_FFCF; k++)
+        write_line(f, rv->fFFCF[k], rv->iFFCF[k], rv->iFFCF_BUFFER_SIZE[k]);
+
+    if(rv->engine == REVERB_ENGINE_COMB8)
+        write_comb8(f, rv);
+    else if(rv->engine == REVERB_ENGINE_VELVET)
+        write_velvet(f, rv);
+
+    if(rv->decimation > 1)
+        write_multirate(f, rv);
+
+    return !ferror(f);
+}
+
+bool reverb_load_state(reverb_t* rv, FILE* f)
+{
+    char magic[4];
+    uint32_t version, numAP, numFFCF;
+    uint32_t decimation = 1;
+    uint32_t engine = REVERB_ENGINE_SCHROEDER;
+
+    if(fread(magic, 1, 4, f) != 4 || memcmp(magic, "RVST", 4))
+        return false;
+    if(!read_u32(f, &version) || (version < 1 || version > STATE_VERSION))
+        return false;
+    if(!read_u32(f, &numAP) || numAP != REVERB_NUM_AP)
+        return false;
+    if(!read_u32(f, &numFFCF) || numFFCF != REVERB_NUM_FFCF)
+        return false;
+    if(!read_float(f, &rv->dryWet) || !read_float(f, &rv->modReverb))
+        return false;
+    // The delay line layout depends on the decimation, it can't change
+    if(version >= 2 && !read_u32(f, &decimation))
+        return false;
+    if((int)decimation != rv->decimation)
+        return false;
+    // Select the engine with reverb_set_engine() before loading
+    if(version >= 3 && !read_u32(f, &engine))
+        return false;
+    if((int)engine != rv->engine)
+        return false;
+
+    for(int k = 0; k < REVERB_NUM_AP; k++)
+    {
+        if(!read_line(f, rv->fAP[k], &rv->iAP[k], &rv->iAP_BUFFER_SIZE[k], rv->iMaxBufferSize))
+            return false;
+    }
+
+    for(int k = 0; k < REVERB_NUM_FFCF; k++)
+    {
+        if(!read_line(f, rv->fFFCF[k], &rv->iFFCF[k], &rv->iFFCF_BUFFER_SIZE[k], rv->iMaxBufferSize))
+            return false;
+    }
+
+    if(rv->engine == REVERB_ENGINE_COMB8 && !read_comb8(f, rv))
+        return false;
+    if(rv->engine == REVERB_ENGINE_VELVET && !read_velvet(f, rv))
+        return false;
+
+    if(rv->decimation > 1 && !read_multirate(f, rv))
+        return false;
+
+    return true;
+}
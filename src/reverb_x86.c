@@ -11,13 +11,14 @@ Description:
 #include <math.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 //#define DEBUG
 
-#if defined(_MSC_VER)
 #include <getopt.h>
-#else
+#if !defined(_MSC_VER)
 #include <unistd.h>
 #endif
 
@@ -29,188 +30,568 @@ extern "C" {
 #ifdef __cplusplus
 }
 #endif
+#include "reverb.h"
+#include "sweep.h"
+#include "bench.h"
+#include "conform.h"
+#include "reverbd.h"
+#include "plan.h"
+#include "profile.h"
+#include "telemetry.h"
+#include "early.h"
+#include "automation.h"
+#include "rt.h"
+
+// Number of frames read, processed and written per iteration for the
+// sweep and the daemon, the local engine uses the planned block length
+#define BLOCK_FRAMES 4096
+
+#define RT_PRIORITY 80 // SCHED_FIFO priority of the --rt render thread
+
+#define TAIL_MAX_SECONDS 60 // --tail gives up after this much past the input
 
-const int iMAX_BUFFER_SIZE = (2*48000); // 2 seconds max reverb
-
-int iFFCF1_BUFFER_SIZE = 1687;
-int iFFCF2_BUFFER_SIZE = 1601;
-int iFFCF3_BUFFER_SIZE = 2053;
-int iFFCF4_BUFFER_SIZE = 2251;
-const float fFFCF1_GAIN = 0.773;
-const float fFFCF2_GAIN = 0.802f;
-const float fFFCF3_GAIN = 0.753f;
-const float fFFCF4_GAIN = 0.733f;
-
-int iAP1_BUFFER_SIZE = 347;
-int iAP2_BUFFER_SIZE = 113;
-int iAP3_BUFFER_SIZE = 37;
-const float fAP1_GAIN = 0.7f;
-const float fAP2_GAIN = 0.7f;
-const float fAP3_GAIN = 0.7f;
-
-int32_t inL, inR, outL, outR;
-
-// Buffer
-float *fFFCF1;
-float *fFFCF2;
-float *fFFCF3;
-float *fFFCF4;
-float *fAP1;
-float *fAP2;
-float *fAP3;
-
-// Index to access the buffer
-int iFFCF1 = 0;
-int iFFCF2 = 0;
-int iFFCF3 = 0;
-int iFFCF4 = 0;
-int iAP1 = 0;
-int iAP2 = 0;
-int iAP3 = 0;
-
-float dryWet = 0;
-float modReverb = 0;
-
-void cleanup(void);
-
-bool setup(void)
+void usage(const char* name)
 {
+    fprintf(stderr, "%s [options] in.wav out.wav <dry/wet in a range of 0...100 percent> <modReverb in a range of 0...100 percent>\n", name);
+    fprintf(stderr, "use - as in.wav or out.wav to read from stdin or write to stdout\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -s, --sweep <dryWet list>:<modReverb list>\n");
+    fprintf(stderr, "        render every combination from one pass over in.wav, e.g. -s 20,40,60:0,50\n");
+    fprintf(stderr, "        writes out_dw<dryWet>_mod<modReverb>.wav per variant\n");
+    fprintf(stderr, "  -d, --decimate <2|4>\n");
+    fprintf(stderr, "        run the reverb network at fs/2 or fs/4, dry path stays at full rate\n");
+    fprintf(stderr, "  --load-state <file>\n");
+    fprintf(stderr, "        continue from a saved engine state, its modReverb is used\n");
+    fprintf(stderr, "  --save-state <file>\n");
+    fprintf(stderr, "        save the engine state after processing in.wav\n");
+    fprintf(stderr, "  --bench [modReverb]\n");
+    fprintf(stderr, "        benchmark full rate against decimated networks on white noise\n");
+    fprintf(stderr, "  --conform <dir> [record]\n");
+    fprintf(stderr, "        check every engine and kernel against the reference outputs and speed baseline in dir\n");
+    fprintf(stderr, "        record: write them from this build instead\n");
+    fprintf(stderr, "  --daemon <socket> [pool]\n");
+    fprintf(stderr, "        serve clients from warm engines until SIGINT/SIGTERM, pool engines up front (default 4)\n");
+    fprintf(stderr, "  --connect <socket>\n");
+    fprintf(stderr, "        process in.wav through a running daemon instead of a local engine\n");
+    fprintf(stderr, "  --loadgen <socket> [clients] [clips]\n");
+    fprintf(stderr, "        benchmark a running daemon with short clips (default 4 clients, 50 clips each)\n");
+    fprintf(stderr, "  --plan=<estimate|measure|exhaustive>\n");
+    fprintf(stderr, "        effort to find the fastest kernel and block length (default measure)\n");
+    fprintf(stderr, "  --kernel <fused|staged|threaded|simd|scan>\n");
+    fprintf(stderr, "        use this network kernel instead of the planned one, scan is faster but\n");
+    fprintf(stderr, "        not bit exact (within one int16 LSB, depends on the block split)\n");
+    fprintf(stderr, "  --wisdom <file>\n");
+    fprintf(stderr, "        where measured plans are kept (default $HOME/.reverb_wisdom), - for none\n");
+    fprintf(stderr, "  --trace <file>\n");
+    fprintf(stderr, "        profiling build only: write a Chrome trace / Perfetto JSON of the sampled blocks\n");
+    fprintf(stderr, "  --metrics <file>\n");
+    fprintf(stderr, "        clip counts per stage, peak/RMS and delay line energy, updated every second\n");
+    fprintf(stderr, "  --early <taps.txt>\n");
+    fprintf(stderr, "        early reflections from a tap table (delay ms, gain, pan per line) ahead of the network\n");
+    fprintf(stderr, "  --engine <schroeder|comb8|velvet>\n");
+    fprintf(stderr, "        comb8: eight damped feedback combs in place of the four feed forward combs\n");
+    fprintf(stderr, "        velvet: sparse velvet noise convolution in place of the combs, the cheapest tail\n");
+    fprintf(stderr, "  --automation <file>\n");
+    fprintf(stderr, "        dryWet / modReverb breakpoints over time (seconds parameter percent per line)\n");
+    fprintf(stderr, "  --rt\n");
+    fprintf(stderr, "        real-time mode: engine and block buffers from one prefaulted, locked arena,\n");
+    fprintf(stderr, "        rendering on a SCHED_FIFO thread\n");
+    fprintf(stderr, "  --rt-cpu <n>\n");
+    fprintf(stderr, "        --rt with the render thread pinned to cpu n\n");
+    fprintf(stderr, "  --tail <dBFS>\n");
+    fprintf(stderr, "        keep rendering past the end of in.wav until nothing left in the delay\n");
+    fprintf(stderr, "        lines is above this level, e.g. --tail -90 (about one LSB)\n");
+    fprintf(stderr, "  --io <stdio|uring>\n");
+    fprintf(stderr, "        how in.wav and out.wav are read and written, uring: io_uring with several\n");
+    fprintf(stderr, "        blocks in flight and O_DIRECT where possible (Linux, default stdio)\n");
+    fprintf(stderr, "  --io-bench <file.wav>\n");
+    fprintf(stderr, "        read and write throughput of both I/O backends on a large file\n");
+}
 
-    fFFCF1 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fFFCF1)
-        return false;
-
-    fFFCF2 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fFFCF2)
-        return false;
-
-    fFFCF3 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fFFCF3)
-        return false;
-
-    fFFCF4 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fFFCF4)
-        return false;
-
-    fAP1 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fAP1)
-        return false;
+enum
+{
+    OPT_LOAD_STATE = 256,
+    OPT_SAVE_STATE,
+    OPT_BENCH,
+    OPT_DAEMON,
+    OPT_CONNECT,
+    OPT_LOADGEN,
+    OPT_PLAN,
+    OPT_WISDOM,
+    OPT_TRACE,
+    OPT_METRICS,
+    OPT_EARLY,
+    OPT_ENGINE,
+    OPT_CONFORM,
+    OPT_AUTOMATION,
+    OPT_RT,
+    OPT_RT_CPU,
+    OPT_TAIL,
+    OPT_IO,
+    OPT_IO_BENCH,
+    OPT_KERNEL
+};
+
+static const struct option long_options[] = {
+    { "sweep",      required_argument, NULL, 's'            },
+    { "decimate",   required_argument, NULL, 'd'            },
+    { "bench",      no_argument,       NULL, OPT_BENCH      },
+    { "daemon",     required_argument, NULL, OPT_DAEMON     },
+    { "connect",    required_argument, NULL, OPT_CONNECT    },
+    { "loadgen",    required_argument, NULL, OPT_LOADGEN    },
+    { "plan",       required_argument, NULL, OPT_PLAN       },
+    { "wisdom",     required_argument, NULL, OPT_WISDOM     },
+    { "trace",      required_argument, NULL, OPT_TRACE      },
+    { "metrics",    required_argument, NULL, OPT_METRICS    },
+    { "early",      required_argument, NULL, OPT_EARLY      },
+    { "engine",     required_argument, NULL, OPT_ENGINE     },
+    { "conform",    required_argument, NULL, OPT_CONFORM    },
+    { "automation", required_argument, NULL, OPT_AUTOMATION },
+    { "rt",         no_argument,       NULL, OPT_RT         },
+    { "rt-cpu",     required_argument, NULL, OPT_RT_CPU     },
+    { "tail",       required_argument, NULL, OPT_TAIL       },
+    { "io",         required_argument, NULL, OPT_IO         },
+    { "io-bench",   required_argument, NULL, OPT_IO_BENCH   },
+    { "kernel",     required_argument, NULL, OPT_KERNEL     },
+    { "load-state", required_argument, NULL, OPT_LOAD_STATE },
+    { "save-state", required_argument, NULL, OPT_SAVE_STATE },
+    { NULL,         0,                 NULL, 0              }
+};
+
+// Everything the local render loop uses, set up by main()
+typedef struct
+{
+    void* wavIn;
+    void* wavOut;
+    int channels;
+    int sampleRate;
+    int input_size;
+    uint8_t* input_buf;
+    int16_t* output_buf;
+    float* fIn;
+    float* fWet;
+    float* fOut;
+    reverb_t* rv;
+    float dryWet;
+    automation_t* am;  // NULL without --automation
+    float* fDryWet;
+    early_t* er;       // NULL without --early
+    float* fEarly;
+    float* fLeft;
+    float* fRight;
+    const char* metrics;
+    bool rt;           // on the --rt thread, the main thread writes the metrics
+    bool tail;         // go on past the input until the lines are empty
+    float tailLevel;   // line peak to stop below
+    int64_t pos;       // frames rendered
+    int64_t tailFrames; // of them past the input
+} render_t;
+
+// The tail is over once no sample left in the delay lines is above
+// tailLevel. The wet block is checked first, going over the lines only pays
+// off once it is quiet too.
+static bool tailDone(const reverb_t* rv, const early_t* er, const float* wet, int frames, float tailLevel)
+{
+    float peak;
+    double energy;
 
-    fAP2 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fAP2)
+    telemetry_peak_energy(wet, frames, &peak, &energy);
+    if (peak > tailLevel)
         return false;
 
-    fAP3 = (float*)malloc(iMAX_BUFFER_SIZE*sizeof(float));
-    if(!fAP3)
+    reverb_line_peak_energy(rv, &peak, &energy);
+    if (peak > tailLevel)
         return false;
 
-    return true;
+    if (er)
+        early_peak_energy(er, &peak, &energy);
 
+    return peak <= tailLevel;
 }
 
-void usage(const char* name)
+// Publish the engine stats to the --metrics file, not from the --rt thread
+static void writeMetrics(void* arg)
 {
-    fprintf(stderr, "%s in.wav out.wav <dry/wet in a range of 0...100 percent>\n", name);
-}
-
-// NOTE: and TODO: currently only wav 16 bit is supported 
-#define MAX_SMP_VAL (1.f * 32767.f)
-#define MIN_SMP_VAL (-1.f * 32767.f)
+    render_t* r = (render_t*)arg;
+    telemetry_stats_t st;
 
-inline float hardClip(float x)
-{
-    return (x > MAX_SMP_VAL) ? MAX_SMP_VAL : (x < MIN_SMP_VAL) ? MIN_SMP_VAL : x;
+    telemetry_read(r->rv->telemetry, &st);
+    telemetry_write_metrics(r->metrics, &st);
 }
 
-// Process a all pass
-float processAP(float x, float g, float* state, int* i, int iBufsize)
+// Read, process and write in.wav to the end, on the main or the --rt thread
+static void* renderLocal(void* arg)
 {
-    float y;
-    int index = *i;
-
-    y = -g * x + state[index];
-    y *= (1 - g*g); // Added due to high gain -> clipping
-
-    state[index] = g * state[(index-1+iBufsize)%iBufsize] + g * x;//x;//g * x;//
+    render_t* r = (render_t*)arg;
+    void* wavIn = r->wavIn;
+    void* wavOut = r->wavOut;
+    const int channels = r->channels;
+    const int input_size = r->input_size;
+    uint8_t* input_buf = r->input_buf;
+    int16_t* output_buf = r->output_buf;
+    float* fIn = r->fIn;
+    float* fWet = r->fWet;
+    float* fOut = r->fOut;
+    reverb_t* rv = r->rv;
+    float dryWet = r->dryWet;
+    automation_t* am = r->am;
+    float* fDryWet = r->fDryWet;
+    early_t* er = r->er;
+    float* fEarly = r->fEarly;
+    float* fLeft = r->fLeft;
+    float* fRight = r->fRight;
+    const char* metrics = r->metrics;
+    time_t lastMetrics = 0;
+    int64_t pos = 0;
+    int64_t tailFrames = 0;
+    bool inTail = false;
+
+    while (1)
+    {
+        prof_block_begin();
 
-    if(++index > iBufsize)
-        index = 0;
+        uint64_t t0;
+        int frames = input_size / (2*channels);
 
-    *i = index;
+        if (!inTail)
+        {
+            t0 = PROF_START();
+            int read = wav_read_data(wavIn, input_buf, input_size);
+            PROF_STOP(PROF_WAV_READ, t0);
+            if (read <= 0 && !r->tail)
+            {
+                prof_block_end(0);
+                break;
+            }
+
+            if (read <= 0)
+            {
+                // Silence from here on, nothing to read or convert any more
+                inTail = true;
+                memset(fIn, 0, frames * sizeof(float));
+            }
+            else
+            {
+                frames = read / (2*channels);
+            }
+        }
 
-    return hardClip(y);
-}
+        // Nothing from here to the file write may allocate
+        rt_guard_enter();
 
-// Process a feed backwards comb filer
-float processFBCF(float x, float g, float* state, int* i, int iBufsize)
-{
-    float y;
-    int index = *i;
+        if (!inTail)
+        {
+            t0 = PROF_START();
+            reverb_read_s16(input_buf, fIn, frames, channels);
+            PROF_STOP(PROF_READ_S16, t0);
+        }
 
-    y = x + g * state[index];
-    state[index] = y;
+        // dryWet stays as is while constant, fDryWet holds a ramp
+        bool ramp = am && automation_ramp(am, AUTOMATION_DRYWET, pos, frames, fDryWet, &dryWet);
 
-    if(++index > iBufsize)
-        index = 0;
+        if (er)
+        {
+            t0 = PROF_START();
+            early_process(er, fIn, fEarly, fLeft, fRight, frames);
+            PROF_STOP(PROF_EARLY, t0);
+
+            if (am)
+                automation_process_block(am, rv, pos, fEarly, fWet, frames);
+            else
+                reverb_process_block(rv, fEarly, fWet, frames);
+
+            t0 = PROF_START();
+            early_add_wet(fWet, fLeft, fRight, frames);
+            if (ramp)
+            {
+                reverb_mix_block_ramp(fDryWet, fIn, fLeft, fLeft, frames);
+                reverb_mix_block_ramp(fDryWet, fIn, fRight, fRight, frames);
+            }
+            else
+            {
+                reverb_mix_block(dryWet, fIn, fLeft, fLeft, frames);
+                reverb_mix_block(dryWet, fIn, fRight, fRight, frames);
+            }
+            PROF_STOP(PROF_MIX, t0);
+
+            t0 = PROF_START();
+            reverb_write_s16_stereo(fLeft, fRight, output_buf, frames, channels);
+            PROF_STOP(PROF_WRITE_S16, t0);
+        }
+        else
+        {
+            if (am)
+                automation_process_block(am, rv, pos, fIn, fWet, frames);
+            else
+                reverb_process_block(rv, fIn, fWet, frames);
+
+            t0 = PROF_START();
+            if (ramp)
+                reverb_mix_block_ramp(fDryWet, fIn, fWet, fOut, frames);
+            else
+                reverb_mix_block(dryWet, fIn, fWet, fOut, frames);
+            PROF_STOP(PROF_MIX, t0);
+
+            t0 = PROF_START();
+            reverb_write_s16(fOut, output_buf, frames, channels);
+            PROF_STOP(PROF_WRITE_S16, t0);
+        }
 
-    *i = index;
+        rt_guard_leave();
 
-    return hardClip(y);
-}
+        t0 = PROF_START();
+        wav_write_data(wavOut, (unsigned char*)output_buf, 2*frames*channels);
+        PROF_STOP(PROF_WAV_WRITE, t0);
 
-// Process a feed forward comb filer
-float processFFCF(float x, float g, float* state, int* i, int iBufsize)
-{
-    float y;
-    int index = *i;
+        prof_block_end(frames);
+        pos += frames;
 
-    y = g * x + g * state[index];
-    
-    state[index] = x;
+        if (metrics && !r->rt && time(NULL) != lastMetrics)
+        {
+            writeMetrics(r);
+            lastMetrics = time(NULL);
+        }
 
-    if(++index > iBufsize)
-        index = 0;
+        if (inTail)
+        {
+            tailFrames += frames;
+            if (tailDone(rv, er, fWet, frames, r->tailLevel))
+                break;
+            if (tailFrames >= (int64_t)TAIL_MAX_SECONDS * r->sampleRate)
+            {
+                fprintf(stderr, "WARNING: tail still not below the threshold after %d s, stopping\n", TAIL_MAX_SECONDS);
+                break;
+            }
+        }
+    }
 
-    *i = index;
+    r->pos = pos;
+    r->tailFrames = tailFrames;
 
-    return hardClip(y);
+    return NULL;
 }
 
-// Process mixing matrix
-float processMM(float x1, float x2, float x3, float x4)
+// Block buffers come from the --rt arena when there is one
+static void* blockAlloc(rt_arena_t* arena, size_t size)
 {
-    float s1, s2;
-    s1 = x1 + x3;
-    s2 = x2 + x4;
-
-    float OutA, OutB, OutC, OutD;
-
-    // Different reverb combinations
-    OutA = s1 + s2;
-    OutB = -OutA;
-    OutD = s1 - s2;
-    OutC = -OutD;
-
-    return hardClip(OutA);
+    return arena ? rt_arena_alloc(arena, size) : malloc(size);
 }
 
 int main(int argc, char *argv[])
 {
     const char *infile, *outfile;
-    FILE *out;
     void *wavIn;
     void *wavOut;
     int format, sample_rate, channels, bits_per_sample;
-    uint32_t data_length;
+    uint64_t data_length;
     int input_size;
     uint8_t* input_buf;
-    int16_t* convert_buf;
+    int16_t* output_buf;
+    float* fIn;
+    float* fWet;
+    float* fOut;
+    FILE* info = stdout;
+    const char* sweep = NULL;
+    const char* loadState = NULL;
+    const char* saveState = NULL;
+    float dryWet = 0;
+    float modReverb = 0;
+    reverb_t rv;
+    int decimation = 1;
+    int bench = 0;
+    const char* daemon = NULL;
+    const char* connect = NULL;
+    const char* loadgen = NULL;
+    int effort = PLAN_MEASURE;
+    const char* wisdom = plan_default_wisdom();
+    plan_t plan;
+    const char* trace = NULL;
+    const char* metrics = NULL;
+    const char* earlyTaps = NULL;
+    early_t er;
+    float* fEarly = NULL;
+    float* fLeft = NULL;
+    float* fRight = NULL;
+    int engine = REVERB_ENGINE_SCHROEDER;
+    const char* conform = NULL;
+    const char* automationFile = NULL;
+    automation_t am;
+    float* fDryWet = NULL;
+    int64_t pos = 0;
+    bool rt = false;
+    int rtCpu = -1;
+    rt_arena_t arena;
+    rt_arena_t* rtArena = NULL;
+    bool tail = false;
+    float tailLevel = 0.f;
+    int io = WAV_IO_STDIO;
+    const char* ioBench = NULL;
+    int kernel = -1; // planned
+    int ch;
+
+    while ((ch = getopt_long(argc, argv, "s:d:", long_options, NULL)) != -1)
+    {
+        switch (ch)
+        {
+        case 's':
+            sweep = optarg;
+            break;
+        case 'd':
+            decimation = atoi(optarg);
+            if (decimation != 1 && decimation != 2 && decimation != 4)
+            {
+                fprintf(stderr, "Decimation must be 1, 2 or 4\n");
+                return 1;
+            }
+            break;
+        case OPT_BENCH:
+            bench = 1;
+            break;
+        case OPT_DAEMON:
+            daemon = optarg;
+            break;
+        case OPT_CONNECT:
+            connect = optarg;
+            break;
+        case OPT_LOADGEN:
+            loadgen = optarg;
+            break;
+        case OPT_PLAN:
+            effort = plan_parse_effort(optarg);
+            if (effort < 0)
+            {
+                fprintf(stderr, "Plan must be estimate, measure or exhaustive\n");
+                return 1;
+            }
+            break;
+        case OPT_WISDOM:
+            wisdom = strcmp(optarg, "-") ? optarg : NULL;
+            break;
+        case OPT_TRACE:
+            trace = optarg;
+#ifndef REVERB_PROFILE
+            fprintf(stderr, "WARNING: --trace needs a profiling build (make profile)\n");
+#endif
+            break;
+        case OPT_METRICS:
+            metrics = optarg;
+            break;
+        case OPT_EARLY:
+            earlyTaps = optarg;
+            break;
+        case OPT_ENGINE:
+            for (engine = 0; engine < REVERB_NUM_ENGINES; engine++)
+            {
+                if (!strcmp(optarg, reverb_engine_name(engine)))
+                    break;
+            }
+            if (engine == REVERB_NUM_ENGINES)
+            {
+                fprintf(stderr, "Engine must be schroeder, comb8 or velvet\n");
+                return 1;
+            }
+            break;
+        case OPT_AUTOMATION:
+            automationFile = optarg;
+            break;
+        case OPT_RT:
+            rt = true;
+            break;
+        case OPT_TAIL:
+            tail = true;
+            tailLevel = powf(10.f, atof(optarg) / 20.f) * MAX_SMP_VAL;
+            break;
+        case OPT_RT_CPU:
+            rt = true;
+            rtCpu = atoi(optarg);
+            if (rtCpu < 0)
+            {
+                fprintf(stderr, "cpu must be 0 or above\n");
+                return 1;
+            }
+            break;
+        case OPT_IO:
+            if (!strcmp(optarg, "stdio"))
+                io = WAV_IO_STDIO;
+            else if (!strcmp(optarg, "uring"))
+                io = WAV_IO_URING;
+            else
+            {
+                fprintf(stderr, "I/O backend must be stdio or uring\n");
+                return 1;
+            }
+            break;
+        case OPT_IO_BENCH:
+            ioBench = optarg;
+            break;
+        case OPT_KERNEL:
+            for (kernel = 0; kernel < REVERB_NUM_KERNELS; kernel++)
+            {
+                if (!strcmp(optarg, reverb_kernel_name(kernel)))
+                    break;
+            }
+            if (kernel == REVERB_NUM_KERNELS)
+            {
+                fprintf(stderr, "Kernel must be fused, staged, threaded, simd or scan\n");
+                return 1;
+            }
+            break;
+        case OPT_CONFORM:
+            conform = optarg;
+            break;
+        case OPT_LOAD_STATE:
+            loadState = optarg;
+            break;
+        case OPT_SAVE_STATE:
+            saveState = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
-    if(!setup())
+    if (bench)
     {
-        fprintf(stderr, "setup failed\n");
+        if (argc - optind > 0)
+            modReverb = atoi(argv[optind]);
+        if (modReverb < 0.f || modReverb > 100.f)
+        {
+            fprintf(stderr, "modReverb must be in 0...100 percent\n");
+            return 1;
+        }
+        return bench_run(modReverb/100.f, info);
     }
-    
+
+    if (ioBench)
+        return bench_io(ioBench, info);
+
+    if (conform)
+    {
+        bool record = (argc - optind > 0) && !strcmp(argv[optind], "record");
+        if (argc - optind > (record ? 1 : 0))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        return conform_run(conform, record, info);
+    }
+
+    if (daemon)
+        return reverbd_run(daemon, (argc - optind > 0) ? atoi(argv[optind]) : 4, metrics, info);
+
+    if (loadgen)
+    {
+        int clients = (argc - optind > 0) ? atoi(argv[optind]) : 4;
+        int clips = (argc - optind > 1) ? atoi(argv[optind + 1]) : 50;
+        if (clients <= 0 || clips <= 0)
+        {
+            fprintf(stderr, "clients and clips must be positive\n");
+            return 1;
+        }
+        return reverbd_loadgen(loadgen, clients, clips, info);
+    }
+
     if (argc - optind < 2)
     {
         fprintf(stderr, "Error: not enough parameter provided\n");
@@ -221,6 +602,10 @@ int main(int argc, char *argv[])
     infile = argv[optind];
     outfile = argv[optind + 1];
 
+    // Keep stdout clean for the audio when writing to a pipe
+    if (!strcmp(outfile, "-"))
+        info = stderr;
+
     if (argc - optind > 2)
     {
         dryWet = atoi(argv[optind + 2]);
@@ -231,7 +616,7 @@ int main(int argc, char *argv[])
         modReverb = atoi(argv[optind + 3]);
     }
 
-    wavIn = wav_read_open(infile);
+    wavIn = wav_read_open_io(infile, io);
     if (!wavIn)
     {
         fprintf(stderr, "Unable to open wav file %s\n", infile);
@@ -248,161 +633,382 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    wavOut = wav_write_open(outfile, sample_rate, bits_per_sample, channels);
+    if (channels != 1 && channels != 2)
+    {
+        fprintf(stderr, "channel = %d\n", channels);
+        return -1;
+    }
+
+    if (rt && (sweep || connect))
+    {
+        fprintf(stderr, "--rt can't be combined with --sweep or --connect\n");
+        return 1;
+    }
+    if (tail && (sweep || connect))
+    {
+        fprintf(stderr, "--tail can't be combined with --sweep or --connect\n");
+        return 1;
+    }
+
+    if (sweep)
+    {
+        if (!strcmp(outfile, "-"))
+        {
+            fprintf(stderr, "Sweep needs an output file name, not stdout\n");
+            return 1;
+        }
+        if (loadState || saveState || earlyTaps || engine != REVERB_ENGINE_SCHROEDER || automationFile)
+        {
+            fprintf(stderr, "Sweep can't be combined with --load-state, --save-state, --early, --engine or --automation\n");
+            return 1;
+        }
+        int ret = sweep_run(wavIn, sample_rate, bits_per_sample, channels, decimation, outfile, sweep, info);
+        wav_read_close(wavIn);
+        return ret;
+    }
+
+    if (earlyTaps)
+    {
+        // The reflections are not part of the engine state and the daemon
+        // has no tap table
+        if (loadState || saveState || connect)
+        {
+            fprintf(stderr, "--early can't be combined with --load-state, --save-state or --connect\n");
+            return 1;
+        }
+        if (!early_load(&er, earlyTaps, sample_rate))
+            return 1;
+        fprintf(info, "early reflections: %d taps from %s\n", er.numTaps, earlyTaps);
+    }
+
+    // The daemon only runs Schroeder engines with fixed parameters
+    if (connect && (engine != REVERB_ENGINE_SCHROEDER || automationFile))
+    {
+        fprintf(stderr, "--engine and --automation can't be combined with --connect\n");
+        return 1;
+    }
+
+    // The engine state lives in the daemon, the local one never renders
+    if (connect && (loadState || saveState))
+    {
+        fprintf(stderr, "--load-state and --save-state can't be combined with --connect\n");
+        return 1;
+    }
+
+    if (automationFile)
+    {
+        if (!automation_load(&am, automationFile, sample_rate))
+            return 1;
+        fprintf(info, "automation: %d dryWet and %d modReverb breakpoints from %s\n",
+                automation_points(&am, AUTOMATION_DRYWET), automation_points(&am, AUTOMATION_MOD), automationFile);
+    }
+
+    if (rt)
+    {
+        // The engine, the tap line, the breakpoints and every block buffer
+        // at the longest block a plan uses
+        const size_t floats = rt_arena_bytes(PLAN_MAX_BLOCK * sizeof(float));
+        const size_t bytes = rt_arena_bytes(PLAN_MAX_BLOCK * channels * 2);
+        size_t size = reverb_memory_size(decimation, engine) + 7 * floats + 2 * bytes;
+        if (earlyTaps)
+            size += early_memory_size(&er);
+        if (automationFile)
+            size += automation_memory_size(&am);
+
+        if (!rt_arena_init(&arena, size) || (earlyTaps && !early_move_to_arena(&er, &arena)) ||
+            (automationFile && !automation_move_to_arena(&am, &arena)))
+        {
+            fprintf(stderr, "Unable to allocate the real-time arena\n");
+            return 1;
+        }
+        rtArena = &arena;
+    }
+
+    if (automationFile)
+    {
+        fDryWet = (float*) blockAlloc(rtArena, PLAN_MAX_BLOCK * sizeof(float));
+        if (fDryWet == NULL)
+        {
+            fprintf(stderr, "Unable to allocate memory for buffer\n");
+            return 1;
+        }
+    }
+
+    wavOut = wav_write_open_io(outfile, sample_rate, bits_per_sample, channels, io);
 
     if (!wavOut)
     {
-        fprintf(stderr, "Unable to open wav file for writing %s\n", infile);
+        fprintf(stderr, "Unable to open wav file for writing %s\n", outfile);
+        return 1;
+    }
+
+    if(!reverb_setup_arena(&rv, decimation, rtArena) || !reverb_set_engine(&rv, engine) ||
+       !reverb_enable_telemetry(&rv, metrics != NULL))
+    {
+        fprintf(stderr, "setup failed\n");
         return 1;
     }
 
-    input_size = data_length;
-    input_buf = (uint8_t*) malloc(input_size);
-    convert_buf = (int16_t*) malloc(input_size);
+    // modReverb is only known after clamping further down, the plan too
+    input_size = PLAN_MAX_BLOCK * channels * 2;
+    input_buf = (uint8_t*) blockAlloc(rtArena, input_size);
+    output_buf = (int16_t*) blockAlloc(rtArena, input_size);
+    fIn = (float*) blockAlloc(rtArena, PLAN_MAX_BLOCK * sizeof(float));
+    fWet = (float*) blockAlloc(rtArena, PLAN_MAX_BLOCK * sizeof(float));
+    fOut = (float*) blockAlloc(rtArena, PLAN_MAX_BLOCK * sizeof(float));
+    if (earlyTaps)
+    {
+        fEarly = (float*) blockAlloc(rtArena, PLAN_MAX_BLOCK * sizeof(float));
+        fLeft = (float*) blockAlloc(rtArena, PLAN_MAX_BLOCK * sizeof(float));
+        fRight = (float*) blockAlloc(rtArena, PLAN_MAX_BLOCK * sizeof(float));
+        if (fEarly == NULL || fLeft == NULL || fRight == NULL)
+        {
+            fprintf(stderr, "Unable to allocate memory for buffer\n");
+            return 1;
+        }
+    }
 
-    if (input_buf == NULL || convert_buf == NULL)
+    if (input_buf == NULL || output_buf == NULL || fIn == NULL || fWet == NULL || fOut == NULL)
     {
         fprintf(stderr, "Unable to allocate memory for buffer\n");
         return 1;
     }
 
-    int read = wav_read_data(wavIn, input_buf, input_size);
-
     if(dryWet > 100)
     {
-        printf("WARNING: dryWet > 100 saturating to 100\n");
+        fprintf(info, "WARNING: dryWet > 100 saturating to 100\n");
         dryWet = 100;
     }
     if(dryWet < 0.f)
     {
-        printf("WARNING: dryWet < 0 saturating to 0\n");
+        fprintf(info, "WARNING: dryWet < 0 saturating to 0\n");
         dryWet = 0;
     }
 
-    printf("using dryWet = %f percent \n", dryWet);
+    fprintf(info, "using dryWet = %f percent \n", dryWet);
+    if (decimation > 1)
+        fprintf(info, "running the reverb network at fs/%d\n", decimation);
 
 
     if(modReverb)
     {
         if(modReverb > 100)
         {
-            printf("WARNING: modReverb > 100 saturating to 100\n");
+            fprintf(info, "WARNING: modReverb > 100 saturating to 100\n");
             modReverb = 100;
         }
         if(modReverb < 0.f)
         {
-            printf("WARNING: modReverb < 0 saturating to 0\n");
+            fprintf(info, "WARNING: modReverb < 0 saturating to 0\n");
             modReverb = 0;
         }
-        printf("using modReverb = %f percent \n", modReverb);
+        fprintf(info, "using modReverb = %f percent \n", modReverb);
         modReverb = modReverb/100.f;
 
-        iFFCF1_BUFFER_SIZE = (int)(expf(2.9 * modReverb) * iFFCF1_BUFFER_SIZE);
-        iFFCF2_BUFFER_SIZE = (int)(expf(2.9 * modReverb) * iFFCF2_BUFFER_SIZE);
-        iFFCF3_BUFFER_SIZE = (int)(expf(2.9 * modReverb) * iFFCF3_BUFFER_SIZE);
-        iFFCF4_BUFFER_SIZE = (int)(expf(2.9 * modReverb) * iFFCF4_BUFFER_SIZE);
-        iAP1_BUFFER_SIZE = (int)(expf(2.9 * modReverb) * iAP1_BUFFER_SIZE);
-        iAP2_BUFFER_SIZE = (int)(expf(2.9 * modReverb) * iAP2_BUFFER_SIZE);
-        iAP3_BUFFER_SIZE = (int)(expf(2.9 * modReverb) * iAP3_BUFFER_SIZE);
+        reverb_set_mod(&rv, modReverb);
+
+        for(int k = 0; k < REVERB_NUM_FFCF; k++)
+            fprintf(info, "using iFFCF%d_BUFFER_SIZE = %d\n", k+1, rv.iFFCF_BUFFER_SIZE[k]);
 
-        printf("using iFFCF1_BUFFER_SIZE = %d\n", iFFCF1_BUFFER_SIZE);
-        printf("using iFFCF2_BUFFER_SIZE = %d\n", iFFCF2_BUFFER_SIZE);
-        printf("using iFFCF3_BUFFER_SIZE = %d\n", iFFCF3_BUFFER_SIZE);
-        printf("using iFFCF4_BUFFER_SIZE = %d\n", iFFCF4_BUFFER_SIZE);
+        fprintf(info, "\n");
+        for(int k = 0; k < REVERB_NUM_AP; k++)
+            fprintf(info, "using iAP%d_BUFFER_SIZE = %d\n", k+1, rv.iAP_BUFFER_SIZE[k]);
 
-        printf("\nusing iAP1_BUFFER_SIZE = %d\n", iAP1_BUFFER_SIZE);
-        printf("using iAP2_BUFFER_SIZE = %d\n", iAP2_BUFFER_SIZE);
-        printf("using iAP3_BUFFER_SIZE = %d\n", iAP3_BUFFER_SIZE);
+        if (engine == REVERB_ENGINE_COMB8)
+        {
+            fprintf(info, "\n");
+            for(int k = 0; k < REVERB_COMB8_LANES; k++)
+                fprintf(info, "using comb8 delay %d = %d\n", k+1, rv.iComb8Delay[k]);
+        }
+        else if (engine == REVERB_ENGINE_VELVET)
+        {
+            fprintf(info, "\nusing velvet response of %d samples, %d pulses\n",
+                    rv.iVelvetDelay[REVERB_VELVET_TAPS - 1] + 1, REVERB_VELVET_TAPS);
+        }
+    }
+
+    if (loadState)
+    {
+        FILE* f = fopen(loadState, "rb");
+        if (!f || !reverb_load_state(&rv, f))
+        {
+            fprintf(stderr, "Unable to load state %s\n", loadState);
+            return 1;
+        }
+        fclose(f);
+
+        if (rv.modReverb != modReverb)
+            fprintf(info, "WARNING: using modReverb = %f percent of the loaded state\n", rv.modReverb*100.f);
+        // Without a dry/wet argument continue with the saved one
+        if (argc - optind <= 2)
+            dryWet = rv.dryWet;
+        fprintf(info, "continuing from state %s, dryWet = %f percent\n", loadState, dryWet);
     }
+    rv.dryWet = dryWet;
 
-    printf("data_length = %d\tread = %d\tinput_size = %d \n", data_length, read, input_size);
-    printf("sample_rate = %d\tbits_per_sample = %d\tchannels = %d \n", sample_rate, bits_per_sample, channels);
+    // Plan for the modReverb the render starts with
+    if (automationFile && automation_points(&am, AUTOMATION_MOD))
+        reverb_set_mod(&rv, automation_value(&am, AUTOMATION_MOD, 0) / 100.f);
 
-    int numSamples = read/2;
-    for(unsigned int n = 0; n < numSamples; n++)
+    if (connect)
     {
-        const uint8_t* in = &input_buf[2*n];
-        convert_buf[n] = in[0] | (in[1] << 8);
+        input_size = BLOCK_FRAMES * channels * 2;
     }
-    int pitchOff = 0;
-    // iterate over the audio frames and create three oscillators, seperated in phase by PI/2
-    for(unsigned int n = 0; n < numSamples; n+=channels)
+    else
     {
-        // Read audio inputs
-        if(channels == 1)
+        // The kernels only exist for the Schroeder network, there is nothing to plan for the others
+        if (engine == REVERB_ENGINE_SCHROEDER)
+            plan_create(&plan, decimation, rv.modReverb, effort, wisdom, info);
+        else
+            plan_create(&plan, decimation, rv.modReverb, PLAN_ESTIMATE, NULL, info);
+        // The planner only picks bit exact kernels, scan only comes from here
+        if (kernel >= 0)
+            plan.kernel = kernel;
+        // Its helper thread runs at normal priority and would hold up the render thread
+        if (rt && plan.kernel == REVERB_KERNEL_THREADED)
         {
-            inL = (int32_t)convert_buf[n];///(1<<15);
-            inR = inL;
+            fprintf(info, "WARNING: threaded kernel has no real-time helper, using simd\n");
+            plan.kernel = REVERB_KERNEL_SIMD;
         }
-        else if(channels == 2)
+        if (!reverb_set_kernel(&rv, plan.kernel))
         {
-            // interleaved left right channel
-            inL = (int32_t)convert_buf[n];///(1<<15);
-            inR = (int32_t)convert_buf[n+1];///(1<<15);
+            fprintf(info, "WARNING: %s kernel not available, using fused\n", reverb_kernel_name(plan.kernel));
+            plan.kernel = REVERB_KERNEL_FUSED;
         }
+        input_size = plan.block * channels * 2;
+        if (engine == REVERB_ENGINE_SCHROEDER)
+            fprintf(info, "plan: %s kernel, %d frame blocks (%s)\n", reverb_kernel_name(plan.kernel), plan.block,
+                    (kernel >= 0) ? "--kernel" : plan_effort_name(plan.effort));
         else
+            fprintf(info, "engine: %s, %d frame blocks\n", reverb_engine_name(engine), plan.block);
+    }
+
+    fprintf(info, "data_length = %llu\tinput_size = %d \n", (unsigned long long)data_length, input_size);
+    fprintf(info, "sample_rate = %d\tbits_per_sample = %d\tchannels = %d \n", sample_rate, bits_per_sample, channels);
+    if (io != WAV_IO_STDIO)
+        fprintf(info, "io: %s in, %s out\n", wav_read_io_name(wavIn), wav_write_io_name(wavOut));
+
+    if (connect)
+    {
+        void* c = reverbd_open(connect, BLOCK_FRAMES, dryWet, modReverb*100.f, decimation);
+        if (!c)
+        {
+            fprintf(stderr, "Unable to connect to reverb daemon %s\n", connect);
+            return 1;
+        }
+
+        while (1)
         {
-            fprintf(stderr, "channel = %d\n", channels);
-            return -1;
+            int read = wav_read_data(wavIn, input_buf, input_size);
+            if (read <= 0)
+                break;
+
+            int frames = read / (2*channels);
+            float* block = reverbd_get_block(c);
+            if (!block)
+                break;
+
+            reverb_read_s16(input_buf, block, frames, channels);
+            if (reverbd_wait(c, reverbd_submit(c, frames)) < 0)
+            {
+                fprintf(stderr, "Reverb daemon went away\n");
+                break;
+            }
+            reverb_write_s16(block, output_buf, frames, channels);
+
+            wav_write_data(wavOut, (unsigned char*)output_buf, 2*frames*channels);
         }
 
-        float fInput = (inL + inR) * 0.5f;
+        reverbd_close(c);
+    }
+
+    if (!connect)
+    {
+        render_t r = { wavIn, wavOut, channels, sample_rate, input_size, input_buf, output_buf, fIn, fWet, fOut, &rv,
+                       dryWet, automationFile ? &am : NULL, fDryWet, earlyTaps ? &er : NULL, fEarly, fLeft, fRight,
+                       metrics, rt, tail, tailLevel, 0, 0 };
+
+        if (rt)
+        {
+            if (!rt_arena_lock(&arena))
+                fprintf(info, "WARNING: unable to lock the %zu kB arena, prefaulted only\n", arena.size / 1024);
+            if (!rt_lock_process())
+                fprintf(info, "WARNING: unable to lock the process memory\n");
+            fprintf(info, "rt: %zu kB arena, render thread at SCHED_FIFO %d", arena.size / 1024, RT_PRIORITY);
+            if (rtCpu >= 0)
+                fprintf(info, " on cpu %d", rtCpu);
+            fprintf(info, "\n");
+
+            if (!rt_thread_run(RT_PRIORITY, rtCpu, renderLocal, metrics ? writeMetrics : NULL, &r, info))
+            {
+                fprintf(stderr, "Unable to start the render thread\n");
+                return 1;
+            }
+        }
+        else
+        {
+            renderLocal(&r);
+        }
+        pos = r.pos;
 
-        // Process
-        float ap = fInput;
+        if (tail)
+            fprintf(info, "tail: %.2f s past the end of %s\n", (double)r.tailFrames / sample_rate, infile);
+    }
 
-        ap = processAP(ap, fAP1_GAIN, fAP1, &iAP1, iAP1_BUFFER_SIZE);
-        ap = processAP(ap, fAP2_GAIN, fAP2, &iAP2, iAP2_BUFFER_SIZE);
-        ap = processAP(ap, fAP3_GAIN, fAP3, &iAP3, iAP3_BUFFER_SIZE);
-        
-        float fOutput = processFFCF(ap, fFFCF1_GAIN, fFFCF1, &iFFCF1, iFFCF1_BUFFER_SIZE);
-        fOutput = hardClip(fOutput + processFFCF(ap, fFFCF2_GAIN, fFFCF2, &iFFCF2, iFFCF2_BUFFER_SIZE));
-        fOutput = hardClip(fOutput + processFFCF(ap, fFFCF3_GAIN, fFFCF3, &iFFCF3, iFFCF3_BUFFER_SIZE));
-        fOutput = hardClip(fOutput + processFFCF(ap, fFFCF4_GAIN, fFFCF4, &iFFCF4, iFFCF4_BUFFER_SIZE));
+    // Saved state continues with the values the render ended on
+    if (automationFile && automation_points(&am, AUTOMATION_DRYWET))
+        rv.dryWet = automation_value(&am, AUTOMATION_DRYWET, (pos > 0) ? pos - 1 : 0);
 
-        fOutput *= dryWet/100.f;
-        fOutput += (1.f - dryWet/100.f) * fInput;
+    prof_report(info, trace);
 
+    if (metrics)
+    {
+        telemetry_stats_t st;
+        telemetry_read(rv.telemetry, &st);
+        if (!telemetry_write_metrics(metrics, &st))
+            fprintf(stderr, "Unable to write metrics %s\n", metrics);
+    }
 
-        int16_t oL = (int16_t)fOutput;
-        int16_t oR = (int16_t)fOutput;
-        
-        wav_write_data(wavOut, (unsigned char*)&oL, 2);
+    if (automationFile)
+        automation_cleanup(&am);
+    if (earlyTaps)
+        early_cleanup(&er);
+    if (!rtArena)
+    {
+        free(fOut);
+        free(fDryWet);
+        free(fEarly);
+        free(fLeft);
+        free(fRight);
+        free(fWet);
+        free(fIn);
+        free(output_buf);
+        free(input_buf);
+    }
 
-        if(channels > 1)
+    if (saveState)
+    {
+        FILE* f = fopen(saveState, "wb");
+        if (!f || !reverb_save_state(&rv, f))
         {
-            wav_write_data(wavOut, (unsigned char*)&oR, 2);
+            fprintf(stderr, "Unable to save state %s\n", saveState);
+            if (f)
+                fclose(f);
+            return 1;
         }
-    }    
+        fclose(f);
+    }
 
-    free(convert_buf);
-    free(input_buf);
-    
-    cleanup();
+    reverb_cleanup(&rv);
+    if (rtArena)
+        rt_arena_free(rtArena);
 
-    wav_write_close(wavOut);
     wav_read_close(wavIn);
+    if (wav_write_close(wavOut) != 0)
+    {
+        fprintf(stderr, "Unable to write wav file %s\n", outfile);
+        return 1;
+    }
 
     return 0;
 }
-// cleanup_render() is called once at the end, after the audio has stopped.
-// Release any resources that were allocated in initialise_render().
-
-void cleanup()
-{
-    if(fFFCF1)
-        free(fFFCF1);
-    if(fFFCF2)
-        free(fFFCF2);
-    if(fFFCF3)
-        free(fFFCF3);
-    if(fFFCF4)
-        free(fFFCF4);
-
-    if(fAP1)
-        free(fAP1);
-    if(fAP2)
-        free(fAP2);
-    if(fAP3)
-        free(fAP3);
-}
@@ -0,0 +1,436 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Reverb daemon. A single poll() loop serves all clients. Engines come
+  from a pool that is set up at start and grows on demand, a finished
+  session only clears the used part of its delay lines.
+*/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reverb.h"
+#include "reverbd.h"
+#include "telemetry.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REVERBD_MAX_CLIENTS 256
+
+typedef struct reverbd_engine
+{
+    reverb_t rv;
+    int busy;
+} reverbd_engine_t;
+
+typedef struct reverbd_session
+{
+    int fd;
+    reverbd_ring_t* ring;
+    size_t ring_size;
+    // Copied from the ring header at open, checked against ring_size once.
+    // The client can rewrite the header later, only these are used.
+    uint32_t slots;
+    uint32_t slot_frames;
+    uint32_t done; // slots processed
+    reverbd_engine_t* engine;
+    float dryWet;
+    uint8_t rx[sizeof(reverbd_msg_t)]; // the next message as far as received
+    size_t rxLen;
+} reverbd_session_t;
+
+static volatile sig_atomic_t bStop = 0;
+
+static void onSignal(int sig)
+{
+    (void)sig;
+    bStop = 1;
+}
+
+static reverbd_engine_t* pool = NULL;
+static int poolSize = 0;
+static int poolUsed = 0;
+
+static bool telemetry = false;
+
+static reverbd_engine_t* acquireEngine(int decimation, float modReverb)
+{
+    reverbd_engine_t* e = NULL;
+
+    for(int k = 0; k < poolUsed; k++)
+    {
+        if(!pool[k].busy && pool[k].rv.decimation == decimation)
+        {
+            e = &pool[k];
+            break;
+        }
+    }
+
+    if(!e)
+    {
+        if(poolUsed == poolSize)
+            return NULL;
+        e = &pool[poolUsed];
+        if(!reverb_setup_decimated(&e->rv, decimation) || !reverb_enable_telemetry(&e->rv, telemetry))
+        {
+            reverb_cleanup(&e->rv);
+            return NULL;
+        }
+        poolUsed++;
+    }
+
+    reverb_set_mod(&e->rv, modReverb);
+    reverb_reset(&e->rv);
+    e->busy = 1;
+
+    return e;
+}
+
+static void endSession(reverbd_session_t* s)
+{
+    if(s->engine)
+        s->engine->busy = 0;
+    if(s->ring)
+        munmap(s->ring, s->ring_size);
+    close(s->fd);
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+}
+
+static bool sendMsg(int fd, uint32_t type, uint32_t seq)
+{
+    reverbd_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = type;
+    msg.seq = seq;
+    return send(fd, &msg, sizeof(msg), MSG_NOSIGNAL) == (ssize_t)sizeof(msg);
+}
+
+static bool openSession(reverbd_session_t* s, const reverbd_msg_t* msg)
+{
+    char name[sizeof(msg->shm_name) + 1];
+    struct stat st;
+
+    if(msg->dryWet < 0.f || msg->dryWet > 100.f || msg->modReverb < 0.f || msg->modReverb > 100.f)
+        return false;
+
+    memcpy(name, msg->shm_name, sizeof(msg->shm_name));
+    name[sizeof(msg->shm_name)] = '\0';
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0)
+        return false;
+
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(reverbd_ring_t))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+        return false;
+
+    s->ring = (reverbd_ring_t*)p;
+    s->ring_size = st.st_size;
+
+    // Read each field once, a check and a later use must see the same value
+    reverbd_ring_t* ring = s->ring;
+    s->slots = __atomic_load_n(&ring->slots, __ATOMIC_RELAXED);
+    s->slot_frames = __atomic_load_n(&ring->slot_frames, __ATOMIC_RELAXED);
+    s->done = 0;
+    if(ring->magic != REVERBD_MAGIC || ring->version != REVERBD_VERSION ||
+       s->slots == 0 || s->slot_frames == 0 || s->slot_frames > REVERBD_MAX_FRAMES ||
+       reverbd_ring_size(s->slots, s->slot_frames) > s->ring_size)
+        return false;
+
+    s->engine = acquireEngine(msg->decimation, msg->modReverb/100.f);
+    if(!s->engine)
+        return false;
+    s->dryWet = msg->dryWet;
+
+    return true;
+}
+
+// Process all submitted slots in place, returns the number of slots
+static uint32_t processSlots(reverbd_session_t* s, float* wet)
+{
+    reverbd_ring_t* ring = s->ring;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t done = s->done;
+    const uint32_t start = done;
+
+    // Never run more than a full ring ahead of what was processed
+    if(head - done > s->slots)
+        head = done + s->slots;
+
+    for(; done != head; done++)
+    {
+        reverbd_slot_t* slot = reverbd_ring_slot(ring, s->slots, s->slot_frames, done);
+        uint32_t frames = __atomic_load_n(&slot->frames, __ATOMIC_RELAXED);
+        if(frames > s->slot_frames)
+            frames = s->slot_frames;
+
+        reverb_process_block(&s->engine->rv, slot->samples, wet, frames);
+        reverb_mix_block(s->dryWet, slot->samples, wet, slot->samples, frames);
+    }
+
+    s->done = done;
+    __atomic_store_n(&ring->done, done, __ATOMIC_RELEASE);
+
+    return done - start;
+}
+
+// Counters of all engines, signal levels of the busy ones
+static void writeMetrics(const char* metrics)
+{
+    telemetry_stats_t total;
+
+    memset(&total, 0, sizeof(total));
+    for(int k = 0; k < poolUsed; k++)
+    {
+        telemetry_stats_t st;
+
+        telemetry_read(pool[k].rv.telemetry, &st);
+        if(!pool[k].busy)
+        {
+            st.peakIn = st.peakWet = st.rmsIn = st.rmsWet = 0.f;
+            st.lineEnergy = 0.0;
+        }
+        telemetry_merge(&total, &st);
+    }
+
+    if(!telemetry_write_metrics(metrics, &total))
+        fprintf(stderr, "Unable to write metrics %s\n", metrics);
+}
+
+static bool setNonBlocking(int fd)
+{
+    const int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static int listenOn(const char* socket_path)
+{
+    struct sockaddr_un addr;
+
+    if(strlen(socket_path) >= sizeof(addr.sun_path))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0 || !setNonBlocking(fd))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int reverbd_run(const char* socket_path, int poolInit, const char* metrics, FILE* info)
+{
+    static reverbd_session_t sessions[REVERBD_MAX_CLIENTS];
+    static struct pollfd fds[REVERBD_MAX_CLIENTS + 1];
+    static int fdSession[REVERBD_MAX_CLIENTS + 1];
+    uint64_t numSessions = 0;
+    uint64_t numBlocks = 0;
+    time_t lastMetrics = 0;
+
+    float* wet = (float*)malloc(REVERBD_MAX_FRAMES * sizeof(float));
+    poolSize = REVERBD_MAX_CLIENTS;
+    pool = (reverbd_engine_t*)calloc(poolSize, sizeof(*pool));
+    if(!wet || !pool)
+    {
+        fprintf(stderr, "Unable to allocate memory for the engine pool\n");
+        return 1;
+    }
+
+    telemetry = (metrics != NULL);
+
+    // Warm engines, more are added up to one per client
+    for(int k = 0; k < poolInit && k < poolSize; k++)
+    {
+        if(!reverb_setup(&pool[k].rv) || !reverb_enable_telemetry(&pool[k].rv, telemetry))
+        {
+            fprintf(stderr, "setup failed\n");
+            return 1;
+        }
+        poolUsed++;
+    }
+
+    int lfd = listenOn(socket_path);
+    if(lfd < 0)
+    {
+        fprintf(stderr, "Unable to listen on %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+
+    for(int k = 0; k < REVERBD_MAX_CLIENTS; k++)
+        sessions[k].fd = -1;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(info, "reverbd: listening on %s with %d warm engines\n", socket_path, poolUsed);
+
+    while(!bStop)
+    {
+        int nfds = 0;
+        fds[nfds].fd = lfd;
+        fds[nfds++].events = POLLIN;
+        for(int k = 0; k < REVERBD_MAX_CLIENTS; k++)
+        {
+            if(sessions[k].fd < 0)
+                continue;
+            fdSession[nfds] = k;
+            fds[nfds].fd = sessions[k].fd;
+            fds[nfds++].events = POLLIN;
+        }
+
+        if(metrics && time(NULL) != lastMetrics)
+        {
+            lastMetrics = time(NULL);
+            writeMetrics(metrics);
+        }
+
+        if(poll(fds, nfds, 500) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        if(fds[0].revents & POLLIN)
+        {
+            int cfd = accept(lfd, NULL, NULL);
+            if(cfd >= 0 && !setNonBlocking(cfd))
+            {
+                close(cfd);
+            }
+            else if(cfd >= 0)
+            {
+                int k;
+                for(k = 0; k < REVERBD_MAX_CLIENTS; k++)
+                {
+                    if(sessions[k].fd < 0)
+                        break;
+                }
+                if(k == REVERBD_MAX_CLIENTS)
+                    close(cfd);
+                else
+                    sessions[k].fd = cfd;
+            }
+        }
+
+        for(int n = 1; n < nfds; n++)
+        {
+            reverbd_session_t* s = &sessions[fdSession[n]];
+            reverbd_msg_t msg;
+
+            if(!(fds[n].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            // The sockets don't block, a message may come in pieces and a
+            // client that stalls halfway holds up nobody else. Only a
+            // complete message is acted on.
+            ssize_t got = recv(s->fd, s->rx + s->rxLen, sizeof(s->rx) - s->rxLen, 0);
+            if(got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                continue;
+            if(got <= 0)
+            {
+                endSession(s);
+                continue;
+            }
+            s->rxLen += got;
+            if(s->rxLen < sizeof(s->rx))
+                continue;
+            memcpy(&msg, s->rx, sizeof(msg));
+            s->rxLen = 0;
+
+            switch(msg.type)
+            {
+            case REVERBD_OPEN:
+                if(s->engine || !openSession(s, &msg))
+                {
+                    sendMsg(s->fd, REVERBD_ERROR, 0);
+                    endSession(s);
+                    break;
+                }
+                numSessions++;
+                if(!sendMsg(s->fd, REVERBD_OK, 0))
+                    endSession(s);
+                break;
+            case REVERBD_KICK:
+                if(!s->engine)
+                {
+                    endSession(s);
+                    break;
+                }
+                numBlocks += processSlots(s, wet);
+                // A client that doesn't read its replies fills the socket
+                if(!sendMsg(s->fd, REVERBD_DONE, s->done))
+                    endSession(s);
+                break;
+            case REVERBD_CLOSE:
+            default:
+                endSession(s);
+                break;
+            }
+        }
+    }
+
+    if(metrics)
+        writeMetrics(metrics);
+
+    fprintf(info, "reverbd: %llu sessions, %llu blocks, %d engines\n",
+            (unsigned long long)numSessions, (unsigned long long)numBlocks, poolUsed);
+
+    for(int k = 0; k < REVERBD_MAX_CLIENTS; k++)
+    {
+        if(sessions[k].fd >= 0)
+            endSession(&sessions[k]);
+    }
+    close(lfd);
+    unlink(socket_path);
+
+    for(int k = 0; k < poolUsed; k++)
+        reverb_cleanup(&pool[k].rv);
+    free(pool);
+    free(wet);
+
+    return 0;
+}
+
+#else
+
+int reverbd_run(const char* socket_path, int pool, const char* metrics, FILE* info)
+{
+    fprintf(stderr, "reverbd needs POSIX shared memory and Unix sockets\n");
+    return 1;
+}
+
+#endif
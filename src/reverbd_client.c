@@ -0,0 +1,328 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Client library of the reverb daemon and a load generator for it.
+  The client owns the shared memory ring, it is unlinked as soon as the
+  daemon has mapped it.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reverbd.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct reverbd_client
+{
+    int fd;
+    reverbd_ring_t* ring;
+    size_t ring_size;
+    uint32_t slot_frames;
+    uint32_t head;  // slots submitted
+    uint32_t done;  // slots known to be processed
+} reverbd_client_t;
+
+static bool sendAll(int fd, const reverbd_msg_t* msg)
+{
+    return send(fd, msg, sizeof(*msg), MSG_NOSIGNAL) == (ssize_t)sizeof(*msg);
+}
+
+static bool recvMsg(int fd, reverbd_msg_t* msg)
+{
+    return recv(fd, msg, sizeof(*msg), MSG_WAITALL) == (ssize_t)sizeof(*msg);
+}
+
+void* reverbd_open(const char* socket_path, int slot_frames, float dryWet, float modReverb, int decimation)
+{
+    static uint32_t counter = 0;
+    struct sockaddr_un addr;
+    reverbd_msg_t msg;
+    char name[sizeof(msg.shm_name)];
+
+    if(slot_frames <= 0 || slot_frames > REVERBD_MAX_FRAMES || strlen(socket_path) >= sizeof(addr.sun_path))
+        return NULL;
+
+    reverbd_client_t* c = (reverbd_client_t*)calloc(1, sizeof(*c));
+    if(!c)
+        return NULL;
+    c->fd = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = REVERBD_OPEN;
+    msg.dryWet = dryWet;
+    msg.modReverb = modReverb;
+    msg.decimation = decimation;
+    snprintf(msg.shm_name, sizeof(msg.shm_name), "/reverbd-%d-%u", (int)getpid(),
+             __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+    memcpy(name, msg.shm_name, sizeof(name));
+
+    int shm = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(shm < 0)
+    {
+        free(c);
+        return NULL;
+    }
+
+    c->ring_size = reverbd_ring_size(REVERBD_SLOTS, slot_frames);
+    void* p = MAP_FAILED;
+    if(ftruncate(shm, c->ring_size) == 0)
+        p = mmap(NULL, c->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    close(shm);
+    if(p == MAP_FAILED)
+    {
+        shm_unlink(name);
+        free(c);
+        return NULL;
+    }
+
+    c->ring = (reverbd_ring_t*)p;
+    c->ring->magic = REVERBD_MAGIC;
+    c->ring->version = REVERBD_VERSION;
+    c->ring->slots = REVERBD_SLOTS;
+    c->ring->slot_frames = slot_frames;
+    c->slot_frames = slot_frames;
+
+    c->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    bool ok = c->fd >= 0 &&
+              connect(c->fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+              sendAll(c->fd, &msg) &&
+              recvMsg(c->fd, &msg) &&
+              msg.type == REVERBD_OK;
+
+    // Mapped on both ends now, the name is no longer needed
+    shm_unlink(name);
+
+    if(!ok)
+    {
+        reverbd_close(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+float* reverbd_get_block(void* obj)
+{
+    reverbd_client_t* c = (reverbd_client_t*)obj;
+
+    // Wait for the daemon if all slots are in flight
+    if(c->head - c->done == REVERBD_SLOTS && reverbd_wait(c, c->done + 1) < 0)
+        return NULL;
+
+    return reverbd_ring_slot(c->ring, REVERBD_SLOTS, c->slot_frames, c->head)->samples;
+}
+
+uint32_t reverbd_submit(void* obj, int frames)
+{
+    reverbd_client_t* c = (reverbd_client_t*)obj;
+    reverbd_msg_t msg;
+
+    reverbd_ring_slot(c->ring, REVERBD_SLOTS, c->slot_frames, c->head)->frames = frames;
+    c->head++;
+    __atomic_store_n(&c->ring->head, c->head, __ATOMIC_RELEASE);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = REVERBD_KICK;
+    msg.seq = c->head;
+    sendAll(c->fd, &msg);
+
+    return c->head;
+}
+
+int reverbd_wait(void* obj, uint32_t seq)
+{
+    reverbd_client_t* c = (reverbd_client_t*)obj;
+    reverbd_msg_t msg;
+
+    while((int32_t)(seq - c->done) > 0)
+    {
+        if(!recvMsg(c->fd, &msg) || msg.type != REVERBD_DONE)
+            return -1;
+        c->done = __atomic_load_n(&c->ring->done, __ATOMIC_ACQUIRE);
+    }
+
+    return 0;
+}
+
+void reverbd_close(void* obj)
+{
+    reverbd_client_t* c = (reverbd_client_t*)obj;
+    reverbd_msg_t msg;
+
+    if(c->fd >= 0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.type = REVERBD_CLOSE;
+        sendAll(c->fd, &msg);
+        close(c->fd);
+    }
+    if(c->ring)
+        munmap(c->ring, c->ring_size);
+    free(c);
+}
+
+// Load generator
+
+#define LOADGEN_CLIP_FRAMES  (2*48000)  // 2 s clips
+#define LOADGEN_BLOCK_FRAMES 4096
+
+typedef struct loadgen_thread
+{
+    pthread_t thread;
+    const char* socket_path;
+    int clips;
+    int failed;
+    double* latency;  // per clip, seconds
+} loadgen_thread_t;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* loadgenThread(void* arg)
+{
+    loadgen_thread_t* t = (loadgen_thread_t*)arg;
+    uint32_t seed = (uint32_t)(uintptr_t)t;
+
+    for(int clip = 0; clip < t->clips; clip++)
+    {
+        double t0 = now();
+        void* c = reverbd_open(t->socket_path, LOADGEN_BLOCK_FRAMES, 30.f, (float)(clip % 5) * 20.f, 1);
+        if(!c)
+        {
+            t->failed++;
+            continue;
+        }
+
+        uint32_t seq = 0;
+        for(int pos = 0; pos < LOADGEN_CLIP_FRAMES; pos += LOADGEN_BLOCK_FRAMES)
+        {
+            int frames = LOADGEN_CLIP_FRAMES - pos;
+            if(frames > LOADGEN_BLOCK_FRAMES)
+                frames = LOADGEN_BLOCK_FRAMES;
+
+            float* block = reverbd_get_block(c);
+            if(!block)
+                break;
+            for(int s = 0; s < frames; s++)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                block[s] = ((int32_t)(seed >> 8) - (1 << 23)) * (8000.f / (1 << 23));
+            }
+            seq = reverbd_submit(c, frames);
+        }
+
+        if(reverbd_wait(c, seq) < 0)
+            t->failed++;
+        reverbd_close(c);
+
+        t->latency[clip] = now() - t0;
+    }
+
+    return NULL;
+}
+
+static int compareDouble(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int reverbd_loadgen(const char* socket_path, int clients, int clips, FILE* info)
+{
+    loadgen_thread_t* threads = (loadgen_thread_t*)calloc(clients, sizeof(*threads));
+    double* latency = (double*)calloc((size_t)clients * clips, sizeof(double));
+    int failed = 0;
+
+    if(!threads || !latency)
+    {
+        free(threads);
+        free(latency);
+        return 1;
+    }
+
+    double t0 = now();
+    for(int k = 0; k < clients; k++)
+    {
+        threads[k].socket_path = socket_path;
+        threads[k].clips = clips;
+        threads[k].latency = &latency[(size_t)k * clips];
+        pthread_create(&threads[k].thread, NULL, loadgenThread, &threads[k]);
+    }
+    for(int k = 0; k < clients; k++)
+    {
+        pthread_join(threads[k].thread, NULL);
+        failed += threads[k].failed;
+    }
+    double elapsed = now() - t0;
+
+    const int total = clients * clips;
+    qsort(latency, total, sizeof(double), compareDouble);
+
+    fprintf(info, "loadgen: %d clients x %d clips of %.1f s, %d failed\n", clients, clips,
+            (double)LOADGEN_CLIP_FRAMES / 48000, failed);
+    fprintf(info, "loadgen: %.1f clips/s, %.1fx realtime\n", total / elapsed,
+            total * ((double)LOADGEN_CLIP_FRAMES / 48000) / elapsed);
+    fprintf(info, "loadgen: clip latency median %.2f ms, p99 %.2f ms, max %.2f ms\n",
+            latency[total/2] * 1e3, latency[(int)(total*0.99)] * 1e3, latency[total-1] * 1e3);
+
+    free(latency);
+    free(threads);
+
+    return failed ? 1 : 0;
+}
+
+#else
+
+void* reverbd_open(const char* socket_path, int slot_frames, float dryWet, float modReverb, int decimation)
+{
+    return NULL;
+}
+
+float* reverbd_get_block(void* obj)
+{
+    return NULL;
+}
+
+uint32_t reverbd_submit(void* obj, int frames)
+{
+    return 0;
+}
+
+int reverbd_wait(void* obj, uint32_t seq)
+{
+    return -1;
+}
+
+void reverbd_close(void* obj)
+{
+}
+
+int reverbd_loadgen(const char* socket_path, int clients, int clips, FILE* info)
+{
+    fprintf(stderr, "reverbd needs POSIX shared memory and Unix sockets\n");
+    return 1;
+}
+
+#endif
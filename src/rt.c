@@ -0,0 +1,333 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Real-time arena, thread and malloc guard, see rt.h
+*/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // pthread_setaffinity_np(), g++ defines it already
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rt.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RT_UNIX
+
+#endif
+
+bool rt_arena_init(rt_arena_t* a, size_t size)
+{
+    memset(a, 0, sizeof(*a));
+    size = rt_arena_bytes(size);
+
+#ifdef RT_UNIX
+    // Whole pages of their own, nothing else shares what gets locked
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+        return false;
+    a->base = (uint8_t*)mem;
+#else
+    void* mem = malloc(size + RT_ARENA_ALIGN);
+    if(!mem)
+        return false;
+    a->base = (uint8_t*)rt_arena_bytes((uintptr_t)mem);
+#endif
+
+    a->mem = mem;
+    a->size = size;
+
+    return true;
+}
+
+void rt_arena_free(rt_arena_t* a)
+{
+    if(!a->mem)
+        return;
+
+#ifdef RT_UNIX
+    if(a->locked)
+        munlock(a->base, a->size);
+    munmap(a->mem, a->size);
+#else
+    free(a->mem);
+#endif
+
+    memset(a, 0, sizeof(*a));
+}
+
+void* rt_arena_alloc(rt_arena_t* a, size_t size)
+{
+    size = rt_arena_bytes(size);
+    if(size > a->size - a->used)
+        return NULL;
+
+    uint8_t* p = a->base + a->used;
+    a->used += size;
+
+    // Zero like calloc, this also faults the pages in
+    memset(p, 0, size);
+
+    return p;
+}
+
+bool rt_arena_lock(rt_arena_t* a)
+{
+    // Fault in every page now rather than on the first pass of a line,
+    // keeping what setup already wrote
+    volatile uint8_t* p = a->base;
+    for(size_t k = 0; k < a->size; k += 4096)
+        p[k] = p[k];
+
+#ifdef RT_UNIX
+    a->locked = (mlock(a->base, a->size) == 0);
+#endif
+
+    return a->locked;
+}
+
+void* rt_calloc(rt_arena_t* a, size_t count, size_t size)
+{
+    return a ? rt_arena_alloc(a, count * size) : calloc(count, size);
+}
+
+void rt_free(rt_arena_t* a, void* p)
+{
+    if(!a)
+        free(p);
+}
+
+bool rt_lock_process(void)
+{
+#ifdef RT_UNIX
+    // Not MCL_FUTURE, with a small RLIMIT_MEMLOCK later mappings would fail
+    return mlockall(MCL_CURRENT) == 0;
+#else
+    return false;
+#endif
+}
+
+#ifdef RT_UNIX
+
+typedef struct
+{
+    void* (*fn)(void*);
+    void* arg;
+    int cpu;
+    FILE* info;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;  // fn returned
+} rt_task_t;
+
+// Touch the stack the audio path will grow into
+static __attribute__((noinline)) void prefaultStack(void)
+{
+    volatile uint8_t stack[RT_STACK_PREFAULT];
+
+    for(size_t k = 0; k < sizeof(stack); k += 4096)
+        stack[k] = 0;
+}
+
+static void* rtMain(void* p)
+{
+    rt_task_t* t = (rt_task_t*)p;
+
+#ifdef __linux__
+    if(t->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(t->cpu, &set);
+        if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            fprintf(t->info, "WARNING: unable to pin the render thread to cpu %d\n", t->cpu);
+    }
+#endif
+
+    prefaultStack();
+
+    void* ret = t->fn(t->arg);
+
+    pthread_mutex_lock(&t->lock);
+    t->done = true;
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+
+    return ret;
+}
+
+// Run idle every RT_IDLE_PERIOD seconds until t->fn has returned
+static void idleUntilDone(rt_task_t* t, void (*idle)(void*))
+{
+    struct timespec next;
+    clock_gettime(CLOCK_REALTIME, &next);
+
+    pthread_mutex_lock(&t->lock);
+    while(!t->done)
+    {
+        next.tv_sec += RT_IDLE_PERIOD;
+        while(!t->done && pthread_cond_timedwait(&t->cond, &t->lock, &next) != ETIMEDOUT)
+            ;
+        if(t->done || !idle)
+            continue;
+
+        pthread_mutex_unlock(&t->lock);
+        idle(t->arg);
+        pthread_mutex_lock(&t->lock);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+bool rt_thread_run(int priority, int cpu, void* (*fn)(void*), void (*idle)(void*), void* arg, FILE* info)
+{
+    rt_task_t t;
+    pthread_attr_t attr;
+    struct sched_param param;
+    pthread_t thread;
+
+    memset(&t, 0, sizeof(t));
+    t.fn = fn;
+    t.arg = arg;
+    t.cpu = cpu;
+    t.info = info;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+
+    pthread_mutex_init(&t.lock, NULL);
+    pthread_cond_init(&t.cond, NULL);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+
+    int err = pthread_create(&thread, &attr, rtMain, &t);
+    pthread_attr_destroy(&attr);
+
+    if(err == EPERM || err == EINVAL)
+    {
+        fprintf(info, "WARNING: no SCHED_FIFO priority %d (%s), rendering at normal priority\n", priority, strerror(err));
+        err = pthread_create(&thread, NULL, rtMain, &t);
+    }
+    if(err == 0)
+    {
+        idleUntilDone(&t, idle);
+        pthread_join(thread, NULL);
+    }
+
+    pthread_cond_destroy(&t.cond);
+    pthread_mutex_destroy(&t.lock);
+
+    return err == 0;
+}
+
+#else
+
+bool rt_thread_run(int priority, int cpu, void* (*fn)(void*), void (*idle)(void*), void* arg, FILE* info)
+{
+    fprintf(info, "WARNING: no real-time threads here, rendering on the main thread\n");
+    fn(arg);
+
+    return true;
+}
+
+#endif
+
+#if defined(RT_MALLOC_GUARD) && defined(__GLIBC__)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// glibc's own entry points, the definitions below replace the public ones
+// for the whole process
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void __libc_free(void* p);
+
+// The exception specification glibc declares them with in C++
+#ifdef __cplusplus
+#define GUARD_THROW __THROW
+#else
+#define GUARD_THROW
+#endif
+
+static __thread int rtGuard;
+
+static void guardAbort(const char* fn)
+{
+    // No stdio, it may allocate itself
+    static const char msg[] = " called on the audio thread, aborting\n";
+    if(write(STDERR_FILENO, fn, strlen(fn)) > 0)
+        (void)!write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    abort();
+}
+
+void* malloc(size_t size) GUARD_THROW
+{
+    if(rtGuard)
+        guardAbort("malloc");
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) GUARD_THROW
+{
+    if(rtGuard)
+        guardAbort("calloc");
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* p, size_t size) GUARD_THROW
+{
+    if(rtGuard)
+        guardAbort("realloc");
+    return __libc_realloc(p, size);
+}
+
+void free(void* p) GUARD_THROW
+{
+    if(rtGuard && p)
+        guardAbort("free");
+    __libc_free(p);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+void rt_guard_enter(void)
+{
+    rtGuard = 1;
+}
+
+void rt_guard_leave(void)
+{
+    rtGuard = 0;
+}
+
+#else
+
+void rt_guard_enter(void)
+{
+}
+
+void rt_guard_leave(void)
+{
+}
+
+#endif
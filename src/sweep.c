@@ -0,0 +1,216 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Parameter sweep rendering. The wet signal only depends on modReverb, so
+  every distinct modReverb gets one reverb_t and all dryWet variants
+  sharing it are mixed from the same wet block. The input is read and
+  converted once, all networks run in lock-step on the same block.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reverb.h"
+#include "sweep.h"
+#include "wavreader.h"
+#include "wavwriter.h"
+
+#define SWEEP_BLOCK_FRAMES 4096
+
+typedef struct sweep_variant
+{
+    float dryWet;
+    float modReverb;
+    int net;         // index of the network rendering the wet signal
+    void* wavOut;
+} sweep_variant_t;
+
+// Values naming the same output file, see variantName()
+static bool sameName(float a, float b)
+{
+    char na[32], nb[32];
+
+    snprintf(na, sizeof(na), "%g", a);
+    snprintf(nb, sizeof(nb), "%g", b);
+
+    return !strcmp(na, nb);
+}
+
+// Parse a comma separated list of percent values. -1 on a bad value, -2
+// on a duplicate, two variants would write the same file.
+static int parseList(const char* str, const char* end, float* values)
+{
+    int num = 0;
+
+    while(str < end)
+    {
+        char* next;
+        float value = strtof(str, &next);
+        if(next == str || num == SWEEP_MAX_VALUES)
+            return -1;
+        if(value < 0.f || value > 100.f)
+            return -1;
+        for(int k = 0; k < num; k++)
+        {
+            if(sameName(values[k], value))
+                return -2;
+        }
+        values[num++] = value;
+        str = next;
+        if(str < end && *str++ != ',')
+            return -1;
+    }
+
+    return num;
+}
+
+static void variantName(char* name, size_t size, const char* outfile, float dryWet, float modReverb)
+{
+    size_t len = strlen(outfile);
+
+    if(len > 4 && !strcmp(outfile + len - 4, ".wav"))
+        len -= 4;
+
+    snprintf(name, size, "%.*s_dw%g_mod%g.wav", (int)len, outfile, dryWet, modReverb);
+}
+
+int sweep_run(void* wavIn, int sample_rate, int bits_per_sample, int channels, int decimation,
+              const char* outfile, const char* grid, FILE* info)
+{
+    float dryWets[SWEEP_MAX_VALUES];
+    float mods[SWEEP_MAX_VALUES];
+    reverb_t nets[SWEEP_MAX_VALUES];
+    sweep_variant_t variants[SWEEP_MAX_VALUES*SWEEP_MAX_VALUES];
+    int numDryWet, numMod, numNets = 0, numVariants = 0;
+    int ret = 1;
+
+    const char* sep = strchr(grid, ':');
+    if(!sep)
+    {
+        fprintf(stderr, "Bad sweep grid %s, expected <dryWet list>:<modReverb list>\n", grid);
+        return 1;
+    }
+
+    numDryWet = parseList(grid, sep, dryWets);
+    numMod = parseList(sep + 1, sep + 1 + strlen(sep + 1), mods);
+    if(numDryWet == -2 || numMod == -2)
+    {
+        fprintf(stderr, "Bad sweep grid %s, a value is listed twice\n", grid);
+        return 1;
+    }
+    if(numDryWet <= 0 || numMod <= 0)
+    {
+        fprintf(stderr, "Bad sweep grid %s, values must be in 0...100 percent\n", grid);
+        return 1;
+    }
+
+    // One network per distinct modReverb
+    for(int m = 0; m < numMod; m++)
+    {
+        int net;
+        for(net = 0; net < numNets; net++)
+        {
+            if(nets[net].modReverb == mods[m]/100.f)
+                break;
+        }
+
+        if(net == numNets)
+        {
+            if(!reverb_setup_decimated(&nets[net], decimation))
+            {
+                fprintf(stderr, "setup failed\n");
+                reverb_cleanup(&nets[net]);
+                goto out;
+            }
+            reverb_set_mod(&nets[net], mods[m]/100.f);
+            numNets++;
+        }
+
+        for(int d = 0; d < numDryWet; d++)
+        {
+            char name[1024];
+            sweep_variant_t* v = &variants[numVariants];
+
+            v->dryWet = dryWets[d];
+            v->modReverb = mods[m];
+            v->net = net;
+
+            variantName(name, sizeof(name), outfile, v->dryWet, v->modReverb);
+            v->wavOut = wav_write_open(name, sample_rate, bits_per_sample, channels);
+            if(!v->wavOut)
+            {
+                fprintf(stderr, "Unable to open wav file for writing %s\n", name);
+                goto out;
+            }
+            numVariants++;
+
+            fprintf(info, "sweep: %s (dryWet = %g, modReverb = %g)\n", name, v->dryWet, v->modReverb);
+        }
+    }
+
+    fprintf(info, "sweep: %d variants from %d networks\n", numVariants, numNets);
+
+    {
+        const int input_size = SWEEP_BLOCK_FRAMES * channels * 2;
+        uint8_t* input_buf = (uint8_t*)malloc(input_size);
+        int16_t* output_buf = (int16_t*)malloc(input_size);
+        float* fIn = (float*)malloc(SWEEP_BLOCK_FRAMES * sizeof(float));
+        float* fOut = (float*)malloc(SWEEP_BLOCK_FRAMES * sizeof(float));
+        float* fWet = (float*)malloc(numNets * SWEEP_BLOCK_FRAMES * sizeof(float));
+
+        if(input_buf && output_buf && fIn && fOut && fWet)
+        {
+            while(1)
+            {
+                int read = wav_read_data(wavIn, input_buf, input_size);
+                if(read <= 0)
+                    break;
+
+                int frames = read / (2*channels);
+                reverb_read_s16(input_buf, fIn, frames, channels);
+
+                for(int net = 0; net < numNets; net++)
+                    reverb_process_block(&nets[net], fIn, &fWet[net*SWEEP_BLOCK_FRAMES], frames);
+
+                for(int k = 0; k < numVariants; k++)
+                {
+                    sweep_variant_t* v = &variants[k];
+                    reverb_mix_block(v->dryWet, fIn, &fWet[v->net*SWEEP_BLOCK_FRAMES], fOut, frames);
+                    reverb_write_s16(fOut, output_buf, frames, channels);
+                    wav_write_data(v->wavOut, (unsigned char*)output_buf, 2*frames*channels);
+                }
+            }
+            ret = 0;
+        }
+        else
+        {
+            fprintf(stderr, "Unable to allocate memory for buffer\n");
+        }
+
+        free(fWet);
+        free(fOut);
+        free(fIn);
+        free(output_buf);
+        free(input_buf);
+    }
+
+out:
+    for(int k = 0; k < numVariants; k++)
+    {
+        if(wav_write_close(variants[k].wavOut) != 0)
+        {
+            char name[1024];
+            variantName(name, sizeof(name), outfile, variants[k].dryWet, variants[k].modReverb);
+            fprintf(stderr, "Unable to write wav file %s\n", name);
+            ret = 1;
+        }
+    }
+    for(int net = 0; net < numNets; net++)
+        reverb_cleanup(&nets[net]);
+
+    return ret;
+}
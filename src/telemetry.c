@@ -0,0 +1,149 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Signal telemetry, see telemetry.h
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reverb.h"
+#include "telemetry.h"
+
+#define TELEMETRY_LANES 8
+
+static const char* const stageNames[TELEMETRY_NUM_STAGES] = {
+    "AP1", "AP2", "AP3", "FFCF1", "FFCF2", "FFCF3", "FFCF4", "combs", "wet"
+};
+
+uint32_t telemetry_clips(const float* x, int n)
+{
+    uint32_t count = 0;
+
+    for(int s = 0; s < n; s++)
+        count += (fabsf(x[s]) >= MAX_SMP_VAL);
+
+    return count;
+}
+
+void telemetry_peak_energy(const float* x, int n, float* peak, double* energy)
+{
+    float p[TELEMETRY_LANES] = { 0 };
+    float e[TELEMETRY_LANES] = { 0 };
+    int s = 0;
+
+    // Independent lanes, float max and sums don't get reordered otherwise
+    for(; s + TELEMETRY_LANES <= n; s += TELEMETRY_LANES)
+    {
+        for(int l = 0; l < TELEMETRY_LANES; l++)
+        {
+            const float v = fabsf(x[s + l]);
+            p[l] = (v > p[l]) ? v : p[l];
+            e[l] += x[s + l] * x[s + l];
+        }
+    }
+    for(; s < n; s++)
+    {
+        const float v = fabsf(x[s]);
+        p[0] = (v > p[0]) ? v : p[0];
+        e[0] += x[s] * x[s];
+    }
+
+    float pk = 0.f;
+    double en = 0.0;
+    for(int l = 0; l < TELEMETRY_LANES; l++)
+    {
+        pk = (p[l] > pk) ? p[l] : pk;
+        en += e[l];
+    }
+
+    *peak = pk;
+    *energy = en;
+}
+
+void telemetry_publish(telemetry_t* tm)
+{
+    const uint32_t seq = tm->seq;
+
+    __atomic_store_n(&tm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    tm->pub = tm->cur;
+    __atomic_store_n(&tm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void telemetry_read(const telemetry_t* tm, telemetry_stats_t* st)
+{
+    uint32_t s0, s1;
+
+    do
+    {
+        s0 = __atomic_load_n(&tm->seq, __ATOMIC_ACQUIRE);
+        *st = tm->pub;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s1 = __atomic_load_n(&tm->seq, __ATOMIC_RELAXED);
+    } while((s0 & 1) || s0 != s1);
+}
+
+void telemetry_merge(telemetry_stats_t* total, const telemetry_stats_t* st)
+{
+    total->blocks += st->blocks;
+    total->frames += st->frames;
+    for(int k = 0; k < TELEMETRY_NUM_STAGES; k++)
+        total->clips[k] += st->clips[k];
+
+    total->peakIn = (st->peakIn > total->peakIn) ? st->peakIn : total->peakIn;
+    total->peakWet = (st->peakWet > total->peakWet) ? st->peakWet : total->peakWet;
+    total->rmsIn = (st->rmsIn > total->rmsIn) ? st->rmsIn : total->rmsIn;
+    total->rmsWet = (st->rmsWet > total->rmsWet) ? st->rmsWet : total->rmsWet;
+    total->lineEnergy = (st->lineEnergy > total->lineEnergy) ? st->lineEnergy : total->lineEnergy;
+}
+
+bool telemetry_write_metrics(const char* path, const telemetry_stats_t* st)
+{
+    char tmp[1100];
+
+    const int len = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if(len < 0 || len >= (int)sizeof(tmp))
+        return false;
+
+    FILE* f = fopen(tmp, "w");
+    if(!f)
+        return false;
+
+    fprintf(f, "# TYPE reverb_blocks_total counter\n");
+    fprintf(f, "reverb_blocks_total %llu\n", (unsigned long long)st->blocks);
+    fprintf(f, "# TYPE reverb_frames_total counter\n");
+    fprintf(f, "reverb_frames_total %llu\n", (unsigned long long)st->frames);
+    fprintf(f, "# TYPE reverb_clips_total counter\n");
+    for(int k = 0; k < TELEMETRY_NUM_STAGES; k++)
+        fprintf(f, "reverb_clips_total{stage=\"%s\"} %llu\n", stageNames[k], (unsigned long long)st->clips[k]);
+    fprintf(f, "# TYPE reverb_peak gauge\n");
+    fprintf(f, "reverb_peak{signal=\"in\"} %.1f\n", st->peakIn);
+    fprintf(f, "reverb_peak{signal=\"wet\"} %.1f\n", st->peakWet);
+    fprintf(f, "# TYPE reverb_rms gauge\n");
+    fprintf(f, "reverb_rms{signal=\"in\"} %.1f\n", st->rmsIn);
+    fprintf(f, "reverb_rms{signal=\"wet\"} %.1f\n", st->rmsWet);
+    fprintf(f, "# TYPE reverb_line_energy gauge\n");
+    fprintf(f, "reverb_line_energy %.6g\n", st->lineEnergy);
+
+    if(fclose(f) != 0)
+    {
+        remove(tmp);
+        return false;
+    }
+
+#ifdef _WIN32
+    remove(path); // rename does not replace on Windows
+#endif
+    if(rename(tmp, path) != 0)
+    {
+        remove(tmp);
+        return false;
+    }
+
+    return true;
+}
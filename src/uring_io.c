@@ -0,0 +1,472 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Sequential file I/O over io_uring, see uring_io.h
+*/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // O_DIRECT, g++ defines it already
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "uring_io.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// No liburing, the three system calls and the shared rings are all it takes
+
+enum
+{
+    SLOT_FREE,    // holds nothing in flight
+    SLOT_PENDING, // submitted, not completed yet
+    SLOT_DONE     // completed, res is valid
+};
+
+typedef struct
+{
+    uint8_t* buf;    // URING_BLOCK bytes, registered as buffer index k
+    uint64_t offset; // file position of buf[0]
+    unsigned len;    // bytes requested
+    int res;         // bytes transferred or -errno
+    int state;       // SLOT_*
+} slot_t;
+
+struct uring_file
+{
+    int fd;
+    int ring;
+    bool direct; // opened with O_DIRECT
+    bool fixed;  // buffers registered with the ring
+    bool writer;
+    bool failed;
+    bool eof;
+
+    // Submission queue, shared with the kernel
+    unsigned* sqTail;
+    unsigned* sqArray;
+    unsigned sqMask;
+    struct io_uring_sqe* sqes;
+    unsigned queued; // entries not passed to io_uring_enter yet
+
+    // Completion queue, shared with the kernel
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+
+    void* sqMap;
+    void* cqMap;
+    size_t sqMapSize;
+    size_t cqMapSize;
+    size_t sqesSize;
+
+    uint8_t* mem;
+    slot_t slot[URING_DEPTH];
+    int cur;       // slot consumed / filled now, the others are in flight
+    size_t pos;    // bytes of it consumed / filled
+    uint64_t next; // file position of the next read ahead
+    uint64_t end;  // end of the range read
+};
+
+static void* mapRing(int ring, size_t size, off_t what)
+{
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, what);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+static bool ringSetup(uring_file_t* f)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    f->ring = (int)syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if(f->ring < 0)
+        return false;
+
+    f->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    f->cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    f->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Since 5.4 both rings are one mapping
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        f->sqMapSize = (f->cqMapSize > f->sqMapSize) ? f->cqMapSize : f->sqMapSize;
+        f->sqMap = mapRing(f->ring, f->sqMapSize, IORING_OFF_SQ_RING);
+        f->cqMap = f->sqMap;
+    }
+    else
+    {
+        f->sqMap = mapRing(f->ring, f->sqMapSize, IORING_OFF_SQ_RING);
+        f->cqMap = mapRing(f->ring, f->cqMapSize, IORING_OFF_CQ_RING);
+    }
+    f->sqes = (struct io_uring_sqe*)mapRing(f->ring, f->sqesSize, IORING_OFF_SQES);
+    if(!f->sqMap || !f->cqMap || !f->sqes)
+        return false;
+
+    uint8_t* sq = (uint8_t*)f->sqMap;
+    uint8_t* cq = (uint8_t*)f->cqMap;
+    f->sqTail = (unsigned*)(sq + p.sq_off.tail);
+    f->sqArray = (unsigned*)(sq + p.sq_off.array);
+    f->sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    f->cqHead = (unsigned*)(cq + p.cq_off.head);
+    f->cqTail = (unsigned*)(cq + p.cq_off.tail);
+    f->cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    f->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    return true;
+}
+
+static void release(uring_file_t* f)
+{
+    if(f->sqes)
+        munmap(f->sqes, f->sqesSize);
+    if(f->cqMap && f->cqMap != f->sqMap)
+        munmap(f->cqMap, f->cqMapSize);
+    if(f->sqMap)
+        munmap(f->sqMap, f->sqMapSize);
+    // Also drops the registered buffers
+    if(f->ring >= 0)
+        close(f->ring);
+    if(f->fd >= 0)
+        close(f->fd);
+    free(f->mem);
+    free(f);
+}
+
+static uring_file_t* uringOpen(const char* filename, int flags, bool writer)
+{
+    uring_file_t* f = (uring_file_t*)calloc(1, sizeof(*f));
+    if(!f)
+        return NULL;
+
+    f->ring = -1;
+    f->writer = writer;
+
+    // Bypass the page cache where the file system lets us, tmpfs e.g. doesn't
+    f->fd = open(filename, flags | O_DIRECT, 0644);
+    f->direct = (f->fd >= 0);
+    if(f->fd < 0 && errno == EINVAL)
+        f->fd = open(filename, flags, 0644);
+
+    void* mem = NULL;
+    if(f->fd < 0 || !ringSetup(f) || posix_memalign(&mem, URING_ALIGN, (size_t)URING_DEPTH * URING_BLOCK) != 0)
+    {
+        release(f);
+        return NULL;
+    }
+    f->mem = (uint8_t*)mem;
+
+    struct iovec iov[URING_DEPTH];
+    for(int k = 0; k < URING_DEPTH; k++)
+    {
+        f->slot[k].buf = f->mem + (size_t)k * URING_BLOCK;
+        iov[k].iov_base = f->slot[k].buf;
+        iov[k].iov_len = URING_BLOCK;
+    }
+
+    // Registered buffers stay pinned instead of being mapped for every
+    // request. Past RLIMIT_MEMLOCK the plain opcodes do the same, slower.
+    f->fixed = (syscall(__NR_io_uring_register, f->ring, IORING_REGISTER_BUFFERS, iov, URING_DEPTH) == 0);
+
+    return f;
+}
+
+// Put slot k on the submission queue, io_uring_enter() passes it on
+static void queue(uring_file_t* f, int k, unsigned len)
+{
+    slot_t* s = &f->slot[k];
+    const unsigned tail = *f->sqTail; // only written here
+    const unsigned idx = tail & f->sqMask;
+    struct io_uring_sqe* sqe = &f->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    if(f->writer)
+        sqe->opcode = f->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    else
+        sqe->opcode = f->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = f->fd;
+    sqe->off = s->offset;
+    sqe->addr = (uint64_t)(uintptr_t)s->buf;
+    sqe->len = len;
+    sqe->buf_index = (uint16_t)k;
+    sqe->user_data = (uint64_t)k;
+
+    f->sqArray[idx] = idx;
+    __atomic_store_n(f->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    s->len = len;
+    s->state = SLOT_PENDING;
+    f->queued++;
+}
+
+// Submit what is queued, then wait for minComplete completions
+static bool enter(uring_file_t* f, unsigned minComplete)
+{
+    const unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+
+    while(1)
+    {
+        const long n = syscall(__NR_io_uring_enter, f->ring, f->queued, minComplete, flags, NULL, 0);
+        if(n >= 0)
+        {
+            f->queued -= (unsigned)n;
+            return true;
+        }
+        if(errno != EINTR)
+        {
+            f->failed = true;
+            return false;
+        }
+    }
+}
+
+static void reap(uring_file_t* f)
+{
+    unsigned head = *f->cqHead;
+    const unsigned tail = __atomic_load_n(f->cqTail, __ATOMIC_ACQUIRE);
+
+    for(; head != tail; head++)
+    {
+        const struct io_uring_cqe* cqe = &f->cqes[head & f->cqMask];
+        slot_t* s = &f->slot[cqe->user_data];
+
+        s->res = cqe->res;
+        s->state = SLOT_DONE;
+
+        // A short write on a regular file means the disk is full
+        if(f->writer && cqe->res != (int)s->len)
+            f->failed = true;
+    }
+
+    __atomic_store_n(f->cqHead, head, __ATOMIC_RELEASE);
+}
+
+static bool waitFor(uring_file_t* f, slot_t* s)
+{
+    while(s->state == SLOT_PENDING)
+    {
+        if(!enter(f, 1))
+            return false;
+        reap(f);
+    }
+
+    return true;
+}
+
+// Refill slot k with the next block of the range, if there is one
+static void readAhead(uring_file_t* f, int k)
+{
+    slot_t* s = &f->slot[k];
+
+    if(f->next >= f->end)
+    {
+        s->state = SLOT_FREE;
+        return;
+    }
+
+    s->offset = f->next;
+    f->next += URING_BLOCK;
+    queue(f, k, URING_BLOCK);
+}
+
+uring_file_t* uring_read_open(const char* filename, uint64_t offset, uint64_t length)
+{
+    uring_file_t* f = uringOpen(filename, O_RDONLY, false);
+    if(!f)
+        return NULL;
+
+    // Blocks are aligned, the first one starts a little before offset
+    f->next = offset & ~(uint64_t)(URING_ALIGN - 1);
+    f->pos = (size_t)(offset - f->next);
+    f->end = offset + length;
+
+    for(int k = 0; k < URING_DEPTH; k++)
+        readAhead(f, k);
+
+    if(!enter(f, 0))
+    {
+        uring_close(f);
+        return NULL;
+    }
+
+    return f;
+}
+
+size_t uring_read(uring_file_t* f, void* data, size_t length)
+{
+    uint8_t* out = (uint8_t*)data;
+    size_t done = 0;
+
+    while(done < length && !f->eof && !f->failed)
+    {
+        slot_t* s = &f->slot[f->cur];
+
+        if(s->state == SLOT_FREE || !waitFor(f, s))
+            break;
+        if(s->res < 0)
+        {
+            f->failed = true;
+            break;
+        }
+
+        uint64_t avail = ((size_t)s->res > f->pos) ? s->res - f->pos : 0;
+        const uint64_t at = s->offset + f->pos;
+        const uint64_t left = (f->end > at) ? f->end - at : 0;
+        avail = (avail < left) ? avail : left;
+
+        const size_t n = (avail < length - done) ? (size_t)avail : length - done;
+        memcpy(out + done, s->buf + f->pos, n);
+        done += n;
+        f->pos += n;
+
+        if(n == avail)
+        {
+            // Used up, short reads only happen at the end of the file
+            if(s->res < URING_BLOCK || n == left)
+                f->eof = true;
+            else
+            {
+                readAhead(f, f->cur);
+                enter(f, 0);
+            }
+            f->cur = (f->cur + 1) % URING_DEPTH;
+            f->pos = 0;
+        }
+    }
+
+    return done;
+}
+
+uring_file_t* uring_write_open(const char* filename, uint64_t offset)
+{
+    uring_file_t* f = uringOpen(filename, O_RDWR | O_CREAT, true);
+    if(!f)
+        return NULL;
+
+    // The block the data starts in is written whole, with what is in the
+    // file in front of offset already in it
+    f->slot[0].offset = offset & ~(uint64_t)(URING_ALIGN - 1);
+    f->pos = (size_t)(offset - f->slot[0].offset);
+    if(f->pos && pread(f->fd, f->slot[0].buf, URING_ALIGN, f->slot[0].offset) < (ssize_t)f->pos)
+    {
+        release(f);
+        return NULL;
+    }
+
+    return f;
+}
+
+// Hand the full slot to the kernel and wait for the one filled next to be free
+static void writeBehind(uring_file_t* f)
+{
+    const uint64_t next = f->slot[f->cur].offset + URING_BLOCK;
+
+    queue(f, f->cur, URING_BLOCK);
+    enter(f, 0);
+
+    f->cur = (f->cur + 1) % URING_DEPTH;
+    f->pos = 0;
+
+    slot_t* s = &f->slot[f->cur];
+    waitFor(f, s);
+    s->state = SLOT_FREE;
+    s->offset = next;
+}
+
+bool uring_write(uring_file_t* f, const void* data, size_t length)
+{
+    const uint8_t* in = (const uint8_t*)data;
+
+    while(length > 0 && !f->failed)
+    {
+        const size_t n = (length < URING_BLOCK - f->pos) ? length : URING_BLOCK - f->pos;
+        memcpy(f->slot[f->cur].buf + f->pos, in, n);
+        f->pos += n;
+        in += n;
+        length -= n;
+
+        if(f->pos == URING_BLOCK)
+            writeBehind(f);
+    }
+
+    return !f->failed;
+}
+
+bool uring_close(uring_file_t* f)
+{
+    const uint64_t size = f->slot[f->cur].offset + f->pos;
+    bool ok = true;
+
+    if(f->writer && f->pos > 0 && !f->failed)
+    {
+        // O_DIRECT takes whole blocks, the padding is cut off below
+        slot_t* s = &f->slot[f->cur];
+        const size_t len = f->direct ? (f->pos + URING_ALIGN - 1) & ~(size_t)(URING_ALIGN - 1) : f->pos;
+        memset(s->buf + f->pos, 0, len - f->pos);
+        queue(f, f->cur, (unsigned)len);
+    }
+
+    // Nothing may be in flight into the buffers once they are freed
+    for(int k = 0; k < URING_DEPTH; k++)
+        ok = waitFor(f, &f->slot[k]) && ok;
+
+    if(f->writer && f->direct && f->pos > 0 && !f->failed)
+        ok = (ftruncate(f->fd, (off_t)size) == 0) && ok;
+
+    ok = ok && !f->failed;
+    release(f);
+
+    return ok;
+}
+
+bool uring_direct(const uring_file_t* f)
+{
+    return f->direct;
+}
+
+#else
+
+uring_file_t* uring_read_open(const char* filename, uint64_t offset, uint64_t length)
+{
+    return NULL;
+}
+
+size_t uring_read(uring_file_t* f, void* data, size_t length)
+{
+    return 0;
+}
+
+uring_file_t* uring_write_open(const char* filename, uint64_t offset)
+{
+    return NULL;
+}
+
+bool uring_write(uring_file_t* f, const void* data, size_t length)
+{
+    return false;
+}
+
+bool uring_close(uring_file_t* f)
+{
+    return false;
+}
+
+bool uring_direct(const uring_file_t* f)
+{
+    return false;
+}
+
+#endif
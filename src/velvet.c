@@ -0,0 +1,179 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Velvet noise tail, see velvet.h
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rt.h"
+#include "simd.h"
+#include "telemetry.h"
+#include "velvet.h"
+
+#define VELVET_NUM_SEGMENTS 4
+#define VELVET_TILE 4 // output vectors per pass over the taps
+
+// Pulses per segment, 60 dB of decay over the whole response
+static const int iVELVET_SEGMENT_TAPS[VELVET_NUM_SEGMENTS] = { 10, 7, 4, 3 };
+static const int iVELVET_DEFAULT_LENGTH = 4800; // 100 ms at 48 kHz
+static const float fVELVET_GAIN = 3.2f;         // about the wet level of the Schroeder network
+static const uint32_t uVELVET_SEED = 0x5eed;
+
+static int responseLength(float modReverb, int decimation)
+{
+    return (int)(expf(2.9 * modReverb) * iVELVET_DEFAULT_LENGTH) / decimation;
+}
+
+// Power of two above the longest delay plus one block of new input
+static int historyRows(int decimation)
+{
+    int rows = 1;
+
+    while(rows <= responseLength(1.f, decimation) + VELVET_MAX_BLOCK)
+        rows <<= 1;
+
+    return rows;
+}
+
+size_t velvet_memory_size(int decimation)
+{
+    return rt_arena_bytes((size_t)historyRows(decimation) * 2 * sizeof(float));
+}
+
+bool velvet_setup(reverb_t* rv)
+{
+    const int rows = historyRows(rv->decimation);
+
+    rv->fVelvet = (float*)rt_calloc(rv->arena, (size_t)rows * 2, sizeof(float));
+    if(!rv->fVelvet)
+        return false;
+
+    rv->iVelvetMask = rows - 1;
+    velvet_set_mod(rv);
+    velvet_reset(rv);
+
+    return true;
+}
+
+void velvet_cleanup(reverb_t* rv)
+{
+    rt_free(rv->arena, rv->fVelvet);
+    rv->fVelvet = NULL;
+}
+
+void velvet_set_mod(reverb_t* rv)
+{
+    const int length = responseLength(rv->modReverb, rv->decimation);
+    const int segment = length / VELVET_NUM_SEGMENTS;
+    const float cell0 = (float)segment / iVELVET_SEGMENT_TAPS[0];
+    uint32_t seed = uVELVET_SEED;
+    double energy = 0.0;
+    int k = 0;
+
+    for(int g = 0; g < VELVET_NUM_SEGMENTS; g++)
+    {
+        const int taps = iVELVET_SEGMENT_TAPS[g];
+        const float cell = (float)segment / taps;
+
+        // Sparser cells get louder pulses, the energy per time follows
+        // the decay only
+        const float density = sqrtf(cell / cell0);
+
+        for(int t = 0; t < taps; t++, k++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            const float offset = (float)(seed >> 8) / (1 << 24) * cell;
+            int delay = g * segment + (int)(t * cell + offset);
+            delay = (delay < length) ? delay : length - 1;
+
+            seed = seed * 1664525u + 1013904223u;
+            const float sign = (seed >> 31) ? -1.f : 1.f;
+            const float gain = sign * density * powf(10.f, -3.f * delay / length);
+
+            rv->iVelvetDelay[k] = delay;
+            rv->fVelvetGain[k] = gain;
+            energy += (double)gain * gain;
+        }
+    }
+
+    // Unit gain for white noise, then the wet level
+    const float norm = fVELVET_GAIN / (float)sqrt(energy);
+    for(k = 0; k < REVERB_VELVET_TAPS; k++)
+        rv->fVelvetGain[k] *= norm;
+}
+
+void velvet_reset(reverb_t* rv)
+{
+    memset(rv->fVelvet, 0, (size_t)(rv->iVelvetMask + 1) * 2 * sizeof(float));
+    rv->iVelvetWrite = 0;
+}
+
+void velvet_process(reverb_t* rv, const float* in, float* out, int n)
+{
+    const int rows = rv->iVelvetMask + 1;
+    float* line = rv->fVelvet;
+    const int write = rv->iVelvetWrite;
+    const float* tap[REVERB_VELVET_TAPS];
+    vf_t gain[REVERB_VELVET_TAPS];
+
+    // The new input first, a tap with a delay below n reads it
+    for(int s = 0; s < n; s++)
+    {
+        const int p = (write + s) & rv->iVelvetMask;
+        line[p] = in[s];
+        line[p + rows] = in[s];
+    }
+
+    for(int k = 0; k < REVERB_VELVET_TAPS; k++)
+    {
+        tap[k] = &line[(write - rv->iVelvetDelay[k]) & rv->iVelvetMask];
+        gain[k] = vf_set1(rv->fVelvetGain[k]);
+    }
+
+    const vf_t lo = vf_set1(MIN_SMP_VAL);
+    const vf_t hi = vf_set1(MAX_SMP_VAL);
+    int s = 0;
+
+    // Across time, VELVET_TILE vectors of output stay in registers while
+    // all taps are added in order, the same sum per sample for any width
+    for(; s + VELVET_TILE * SIMD_LANES <= n; s += VELVET_TILE * SIMD_LANES)
+    {
+        vf_t acc[VELVET_TILE];
+        for(int v = 0; v < VELVET_TILE; v++)
+            acc[v] = gain[0] * vf_loadu(&tap[0][s + v * SIMD_LANES]);
+
+        for(int k = 1; k < REVERB_VELVET_TAPS; k++)
+            for(int v = 0; v < VELVET_TILE; v++)
+                acc[v] = vf_madd(gain[k], vf_loadu(&tap[k][s + v * SIMD_LANES]), acc[v]);
+
+        for(int v = 0; v < VELVET_TILE; v++)
+            vf_storeu(&out[s + v * SIMD_LANES], vf_clamp(acc[v], lo, hi));
+    }
+
+    for(; s < n; s++)
+    {
+        float acc = rv->fVelvetGain[0] * tap[0][s];
+        for(int k = 1; k < REVERB_VELVET_TAPS; k++)
+            acc = rv->fVelvetGain[k] * tap[k][s] + acc;
+        out[s] = hardClip(acc);
+    }
+
+    rv->iVelvetWrite = (write + n) & rv->iVelvetMask;
+}
+
+void velvet_peak_energy(const reverb_t* rv, float* peak, double* energy)
+{
+    int reach = 0;
+    for(int k = 0; k < REVERB_VELVET_TAPS; k++)
+        reach = (rv->iVelvetDelay[k] > reach) ? rv->iVelvetDelay[k] : reach;
+
+    // Contiguous in the second copy
+    const int start = (rv->iVelvetWrite - reach) & rv->iVelvetMask;
+    telemetry_peak_energy(&rv->fVelvet[start], reach, peak, energy);
+}
@@ -16,17 +16,32 @@
  * -------------------------------------------------------------------
  */
 
+#define _FILE_OFFSET_BITS 64
+
 #include "wavreader.h"
+#include "uring_io.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 #define TAG(a, b, c, d) (((a) << 24) | ((b) << 16) | ((c) << 8) | (d))
 
+#if defined(_MSC_VER)
+#define wav_fseek _fseeki64
+#define wav_ftell _ftelli64
+#else
+#define wav_fseek fseeko
+#define wav_ftell ftello
+#endif
+
 struct wav_reader {
 	FILE *wav;
-	uint32_t data_length;
+	uint64_t data_length;
 
 	int format;
 	int sample_rate;
@@ -36,6 +51,9 @@ struct wav_reader {
 	int block_align;
 
 	int streamed;
+	int seekable;
+
+	uring_file_t* io; // NULL for stdio
 };
 
 static uint32_t read_tag(struct wav_reader* wr) {
@@ -56,6 +74,12 @@ static uint32_t read_int32(struct wav_reader* wr) {
 	return value;
 }
 
+static uint64_t read_int64(struct wav_reader* wr) {
+	uint64_t value = read_int32(wr);
+	value |= (uint64_t) read_int32(wr) << 32;
+	return value;
+}
+
 static uint16_t read_int16(struct wav_reader* wr) {
 	uint16_t value = 0;
 	value |= fgetc(wr->wav) << 0;
@@ -63,57 +87,100 @@ static uint16_t read_int16(struct wav_reader* wr) {
 	return value;
 }
 
-static void skip(FILE *f, int n) {
-	int i;
-	for (i = 0; i < n; i++)
-		fgetc(f);
+// Stops at the end of the file, a bogus or streamed (~0) chunk length would
+// spin for ever otherwise. The caller sees feof() and gives up.
+static void skip(FILE *f, uint64_t n) {
+	uint64_t i;
+	for (i = 0; i < n; i++) {
+		if (fgetc(f) == EOF)
+			break;
+	}
+}
+
+// Skip forward, without relying on fseek when reading from a pipe
+static void seek_forward(struct wav_reader* wr, uint64_t n) {
+	if (wr->seekable)
+		wav_fseek(wr->wav, n, SEEK_CUR);
+	else
+		skip(wr->wav, n);
 }
 
 void* wav_read_open(const char *filename) {
+	return wav_read_open_io(filename, WAV_IO_STDIO);
+}
+
+void* wav_read_open_io(const char *filename, int io) {
 	struct wav_reader* wr = (struct wav_reader*) malloc(sizeof(*wr));
-	long data_pos = 0;
+	int64_t data_pos = 0;
+	int rf64 = 0;
 	memset(wr, 0, sizeof(*wr));
 
-	if (!strcmp(filename, "-"))
+	if (!strcmp(filename, "-")) {
+#if defined(_WIN32)
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
 		wr->wav = stdin;
-	else
+	} else {
 		wr->wav = fopen(filename, "rb");
+	}
 	if (wr->wav == NULL) {
 		free(wr);
 		return NULL;
 	}
+	wr->seekable = wav_fseek(wr->wav, 0, SEEK_CUR) == 0;
 
 	while (1) {
-		uint32_t tag, tag2, length;
+		uint32_t tag, tag2;
+		uint64_t length;
 		tag = read_tag(wr);
 		if (feof(wr->wav))
 			break;
 		length = read_int32(wr);
-		if (!length || length >= 0x7fff0000) {
+		if (tag == TAG('R', 'F', '6', '4')) {
+			// The real RIFF size follows in the ds64 chunk
+			rf64 = 1;
+			tag = TAG('R', 'I', 'F', 'F');
+		} else if (!length || length >= 0x7fff0000) {
 			wr->streamed = 1;
 			length = ~0;
 		}
 		if (tag != TAG('R', 'I', 'F', 'F') || length < 4) {
-			fseek(wr->wav, length, SEEK_CUR);
+			seek_forward(wr, length);
 			continue;
 		}
 		tag2 = read_tag(wr);
 		length -= 4;
 		if (tag2 != TAG('W', 'A', 'V', 'E')) {
-			fseek(wr->wav, length, SEEK_CUR);
+			seek_forward(wr, length);
 			continue;
 		}
 		// RIFF chunk found, iterate through it
 		while (length >= 8) {
-			uint32_t subtag, sublength;
+			uint32_t subtag;
+			uint64_t sublength;
 			subtag = read_tag(wr);
 			if (feof(wr->wav))
 				break;
 			sublength = read_int32(wr);
 			length -= 8;
+			if (rf64 && subtag == TAG('d', 'a', 't', 'a') && sublength == 0xffffffff)
+				sublength = wr->data_length;
 			if (length < sublength)
 				break;
-			if (subtag == TAG('f', 'm', 't', ' ')) {
+			if (subtag == TAG('d', 's', '6', '4') && rf64) {
+				uint64_t riff_length;
+				if (sublength < 24) {
+					// Insufficient data for 'ds64'
+					break;
+				}
+				riff_length     = read_int64(wr);
+				wr->data_length = read_int64(wr);
+				skip(wr->wav, sublength - 16);
+				// Everything after 'WAVE' and the ds64 header
+				length = riff_length - 4 - 8;
+				if (length < sublength)
+					break;
+			} else if (subtag == TAG('f', 'm', 't', ' ')) {
 				if (sublength < 16) {
 					// Insufficient data for 'fmt '
 					break;
@@ -136,13 +203,17 @@ void* wav_read_open(const char *filename) {
 					skip(wr->wav, sublength - 16);
 				}
 			} else if (subtag == TAG('d', 'a', 't', 'a')) {
-				data_pos = ftell(wr->wav);
+				data_pos = wav_ftell(wr->wav);
 				wr->data_length = sublength;
 				if (!wr->data_length || wr->streamed) {
 					wr->streamed = 1;
 					return wr;
 				}
-				fseek(wr->wav, sublength, SEEK_CUR);
+				if (!wr->seekable) {
+					// Can't come back to the data later, start reading here
+					return wr;
+				}
+				wav_fseek(wr->wav, sublength, SEEK_CUR);
 			} else {
 				skip(wr->wav, sublength);
 			}
@@ -150,21 +221,27 @@ void* wav_read_open(const char *filename) {
 		}
 		if (length > 0) {
 			// Bad chunk?
-			fseek(wr->wav, length, SEEK_CUR);
+			seek_forward(wr, length);
 		}
 	}
-	fseek(wr->wav, data_pos, SEEK_SET);
+	if (wr->seekable)
+		wav_fseek(wr->wav, data_pos, SEEK_SET);
+	// Only a data chunk at a known place in a file, NULL keeps stdio
+	if (io == WAV_IO_URING && wr->wav != stdin && wr->seekable && data_pos > 0)
+		wr->io = uring_read_open(filename, data_pos, wr->data_length);
 	return wr;
 }
 
 void wav_read_close(void* obj) {
 	struct wav_reader* wr = (struct wav_reader*) obj;
+	if (wr->io)
+		uring_close(wr->io);
 	if (wr->wav != stdin)
 		fclose(wr->wav);
 	free(wr);
 }
 
-int wav_get_header(void* obj, int* format, int* channels, int* sample_rate, int* bits_per_sample, unsigned int* data_length) {
+int wav_get_header(void* obj, int* format, int* channels, int* sample_rate, int* bits_per_sample, uint64_t* data_length) {
 	struct wav_reader* wr = (struct wav_reader*) obj;
 	if (format)
 		*format = wr->format;
@@ -186,8 +263,17 @@ int wav_read_data(void* obj, unsigned char* data, unsigned int length) {
 		return -1;
 	if (length > wr->data_length && !wr->streamed)
 		length = wr->data_length;
-	n = fread(data, 1, length, wr->wav);
+	if (wr->io)
+		n = uring_read(wr->io, data, length);
+	else
+		n = fread(data, 1, length, wr->wav);
 	wr->data_length -= length;
 	return n;
 }
 
+const char* wav_read_io_name(void* obj) {
+	struct wav_reader* wr = (struct wav_reader*) obj;
+	if (!wr->io)
+		return "stdio";
+	return uring_direct(wr->io) ? "io_uring O_DIRECT" : "io_uring";
+}
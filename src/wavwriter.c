@@ -16,19 +16,44 @@
  * -------------------------------------------------------------------
  */
 
+#define _FILE_OFFSET_BITS 64
+
 #include "wavwriter.h"
+#include "wavreader.h"
+#include "uring_io.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#if defined(_MSC_VER)
+#define wav_fseek _fseeki64
+#define wav_ftell _ftelli64
+#else
+#define wav_fseek fseeko
+#define wav_ftell ftello
+#endif
+
+// Size of the ds64 chunk body. The header always reserves this much space in
+// a 'JUNK' chunk so that it can be turned into RF64 in place on close.
+#define DS64_SIZE 28
 
 struct wav_writer {
 	FILE *wav;
-	int data_length;
+	uint64_t data_length;
 
 	int sample_rate;
 	int bits_per_sample;
 	int channels;
+
+	int seekable;
+	int failed; // a write failed, data_length stops there
+
+	uring_file_t* io; // NULL for stdio
 };
 
 static void write_string(struct wav_writer* ww, const char *str) {
@@ -38,24 +63,52 @@ static void write_string(struct wav_writer* ww, const char *str) {
 	fputc(str[3], ww->wav);
 }
 
-static void write_int32(struct wav_writer* ww, int value) {
+static void write_int32(struct wav_writer* ww, uint32_t value) {
 	fputc((value >>  0) & 0xff, ww->wav);
 	fputc((value >>  8) & 0xff, ww->wav);
 	fputc((value >> 16) & 0xff, ww->wav);
 	fputc((value >> 24) & 0xff, ww->wav);
 }
 
+static void write_int64(struct wav_writer* ww, uint64_t value) {
+	write_int32(ww, (uint32_t) value);
+	write_int32(ww, (uint32_t) (value >> 32));
+}
+
 static void write_int16(struct wav_writer* ww, int value) {
 	fputc((value >> 0) & 0xff, ww->wav);
 	fputc((value >> 8) & 0xff, ww->wav);
 }
 
-static void write_header(struct wav_writer* ww, int length) {
+// With streaming set, the RIFF and data sizes are written as 0xffffffff,
+// which readers take as "read until end of file".
+static void write_header(struct wav_writer* ww, uint64_t length, int streaming) {
 	int bytes_per_frame, bytes_per_sec;
-	write_string(ww, "RIFF");
-	write_int32(ww, 4 + 8 + 16 + 8 + length);
+	uint64_t riff_length = 4 + 8 + DS64_SIZE + 8 + 16 + 8 + length;
+	int rf64 = !streaming && riff_length > 0xffffffff;
+	int i;
+
+	write_string(ww, rf64 ? "RF64" : "RIFF");
+	write_int32(ww, (rf64 || streaming) ? 0xffffffff : (uint32_t) riff_length);
 	write_string(ww, "WAVE");
 
+	if (rf64) {
+		uint64_t frames;
+		bytes_per_frame = ww->bits_per_sample/8*ww->channels;
+		frames = bytes_per_frame ? length / bytes_per_frame : 0;
+		write_string(ww, "ds64");
+		write_int32(ww, DS64_SIZE);
+		write_int64(ww, riff_length);  // RIFF size
+		write_int64(ww, length);       // data size
+		write_int64(ww, frames);       // Sample count
+		write_int32(ww, 0);            // Table length
+	} else {
+		write_string(ww, "JUNK");
+		write_int32(ww, DS64_SIZE);
+		for (i = 0; i < DS64_SIZE; i++)
+			fputc(0, ww->wav);
+	}
+
 	write_string(ww, "fmt ");
 	write_int32(ww, 16);
 
@@ -69,42 +122,82 @@ static void write_header(struct wav_writer* ww, int length) {
 	write_int16(ww, ww->bits_per_sample); // Bits per sample
 
 	write_string(ww, "data");
-	write_int32(ww, length);
+	write_int32(ww, (rf64 || streaming) ? 0xffffffff : (uint32_t) length);
 }
 
 void* wav_write_open(const char *filename, int sample_rate, int bits_per_sample, int channels) {
+	return wav_write_open_io(filename, sample_rate, bits_per_sample, channels, WAV_IO_STDIO);
+}
+
+void* wav_write_open_io(const char *filename, int sample_rate, int bits_per_sample, int channels, int io) {
 	struct wav_writer* ww = (struct wav_writer*) malloc(sizeof(*ww));
 	memset(ww, 0, sizeof(*ww));
-	ww->wav = fopen(filename, "wb");
+	if (!strcmp(filename, "-")) {
+#if defined(_WIN32)
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		ww->wav = stdout;
+	} else {
+		ww->wav = fopen(filename, "wb");
+	}
 	if (ww->wav == NULL) {
 		free(ww);
 		return NULL;
 	}
+	ww->seekable = wav_fseek(ww->wav, 0, SEEK_CUR) == 0;
 	ww->data_length = 0;
 	ww->sample_rate = sample_rate;
 	ww->bits_per_sample = bits_per_sample;
 	ww->channels = channels;
 
-	write_header(ww, ww->data_length);
+	// Sizes are patched on close if possible, until then the file reads
+	// as a stream
+	write_header(ww, ww->data_length, 1);
+
+	// The data goes behind the header, which is patched through stdio on
+	// close once the ring is drained. NULL keeps stdio.
+	if (io == WAV_IO_URING && ww->wav != stdout && ww->seekable && fflush(ww->wav) == 0)
+		ww->io = uring_write_open(filename, wav_ftell(ww->wav));
 	return ww;
 }
 
-void wav_write_close(void* obj) {
+int wav_write_close(void* obj) {
 	struct wav_writer* ww = (struct wav_writer*) obj;
+	int ret;
 	if (ww->wav == NULL) {
 		free(ww);
-		return;
+		return -1;
 	}
-	fseek(ww->wav, 0, SEEK_SET);
-	write_header(ww, ww->data_length);
-	fclose(ww->wav);
+	if (ww->io && !uring_close(ww->io))
+		ww->failed = 1;
+	// A file with data missing keeps the streaming header rather than
+	// sizes that make it look complete
+	if (!ww->failed && ww->seekable && wav_fseek(ww->wav, 0, SEEK_SET) == 0)
+		write_header(ww, ww->data_length, 0);
+	if (ww->wav != stdout)
+		ret = fclose(ww->wav);
+	else
+		ret = fflush(ww->wav);
+	ret = (ret != 0 || ww->failed) ? -1 : 0;
 	free(ww);
+	return ret;
 }
 
 void wav_write_data(void* obj, const unsigned char* data, int length) {
 	struct wav_writer* ww = (struct wav_writer*) obj;
-	if (ww->wav == NULL)
+	if (ww->wav == NULL || ww->failed)
 		return;
-	fwrite(data, length, 1, ww->wav);
-	ww->data_length += length;
+	if (ww->io)
+		ww->failed = !uring_write(ww->io, data, length);
+	else
+		ww->failed = length > 0 && fwrite(data, length, 1, ww->wav) != 1;
+	if (!ww->failed)
+		ww->data_length += length;
+}
+
+const char* wav_write_io_name(void* obj) {
+	struct wav_writer* ww = (struct wav_writer*) obj;
+	if (!ww->io)
+		return "stdio";
+	return uring_direct(ww->io) ? "io_uring O_DIRECT" : "io_uring";
 }
@@ -0,0 +1,137 @@
+/*
+Author: Kim Radmacher
+
+Date: 15.09.2022
+
+Description:
+  Helper thread for splitting a block, see worker.h
+*/
+
+#include <stdlib.h>
+
+#include "worker.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <pthread.h>
+
+#define WORKER_SPIN 20000 // polls before sleeping, a block takes some 10 us
+
+struct worker
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    void (*fn)(void*);
+    void* arg;
+    unsigned started;  // tasks handed to the thread
+    unsigned finished; // tasks completed
+    int quit;
+};
+
+static void* workerMain(void* p)
+{
+    worker_t* w = (worker_t*)p;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&w->lock);
+    while(1)
+    {
+        while(!w->quit && w->started == seen)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if(w->quit)
+            break;
+        seen = w->started;
+        pthread_mutex_unlock(&w->lock);
+
+        w->fn(w->arg);
+
+        __atomic_store_n(&w->finished, seen, __ATOMIC_RELEASE);
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+worker_t* worker_create(void)
+{
+    worker_t* w = (worker_t*)calloc(1, sizeof(*w));
+    if(!w)
+        return NULL;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if(pthread_create(&w->thread, NULL, workerMain, w) != 0)
+    {
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+void worker_destroy(worker_t* w)
+{
+    if(!w)
+        return;
+
+    pthread_mutex_lock(&w->lock);
+    w->quit = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+}
+
+void worker_start(worker_t* w, void (*fn)(void*), void* arg)
+{
+    pthread_mutex_lock(&w->lock);
+    w->fn = fn;
+    w->arg = arg;
+    w->started++;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void worker_wait(worker_t* w)
+{
+    // Usually done by the time the caller finished its half, so poll first
+    for(int k = 0; k < WORKER_SPIN; k++)
+    {
+        if(__atomic_load_n(&w->finished, __ATOMIC_ACQUIRE) == w->started)
+            return;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    while(__atomic_load_n(&w->finished, __ATOMIC_ACQUIRE) != w->started)
+        pthread_cond_wait(&w->cond, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+}
+
+#else
+
+worker_t* worker_create(void)
+{
+    return NULL;
+}
+
+void worker_destroy(worker_t* w)
+{
+}
+
+void worker_start(worker_t* w, void (*fn)(void*), void* arg)
+{
+}
+
+void worker_wait(worker_t* w)
+{
+}
+
+#endif